@@ -0,0 +1,267 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <new>
+#include <utility>
+
+#include "Queue.h"
+
+#define CACHE_ALIGN alignas(PLATFORM_CACHE_LINE_SIZE)
+#define Q_NOEXCEPT_ENABLED true
+
+namespace AtomicQueue
+{
+    /**
+     * @brief Fixed-capacity object pool, free blocks circulate through a TBoundedCircularAtomicQueueHeap<T*>.
+     *
+     * All blocks come from one arena allocated up front, each block is padded to whole cache lines so objects
+     * handed to different threads never share a line. Every thread with a Utils::ThreadSlot below TMaxThreads
+     * keeps a magazine of up to TMagazineSize free blocks, so most Allocate/Free calls touch no shared state and
+     * only a magazine that runs empty or full exchanges half its size with the free list. Threads beyond that go
+     * straight to the free list.
+     *
+     * Blocks cached in another thread's magazine are not visible to Allocate, which returns nullptr once this
+     * thread's magazine and the free list are both empty. A thread's magazine goes back to the free list when the
+     * thread exits, and its slot is reused by the next thread.
+     */
+    template<typename T, uint TCapacity, uint TMagazineSize = 32, uint TMaxThreads = 64>
+    class TObjectPool : private Utils::FThreadSlotListener
+    {
+        static_assert(TCapacity > 0,                                           "Pool too small!");
+        static_assert(TMagazineSize >= 2,                                      "Magazine too small!");
+
+        static constexpr uint   BlockAlignment = alignof(T) > PLATFORM_CACHE_LINE_SIZE ? alignof(T) : PLATFORM_CACHE_LINE_SIZE;
+        static constexpr uint   BlockSize = (sizeof(T) + BlockAlignment - 1) / BlockAlignment * BlockAlignment;
+
+        using FFreeList         = TBoundedCircularAtomicQueueHeap<T*, TCapacity>;
+
+        struct CACHE_ALIGN FMagazine
+        {
+            uint32              Count;
+            T*                  Blocks[TMagazineSize];
+        };
+
+    public:
+        /**
+         * @brief Move-only owner of a pooled object, frees it back to the pool on destruction.
+         */
+        class FHandle
+        {
+        public:
+            FHandle() noexcept(Q_NOEXCEPT_ENABLED)
+                : Pool(nullptr),
+                Object(nullptr)
+            {
+            }
+
+            FHandle(TObjectPool* InPool, T* InObject) noexcept(Q_NOEXCEPT_ENABLED)
+                : Pool(InPool),
+                Object(InObject)
+            {
+            }
+
+            FHandle(FHandle&& Other) noexcept(Q_NOEXCEPT_ENABLED)
+                : Pool(Other.Pool),
+                Object(Other.Release())
+            {
+            }
+
+            FHandle& operator=(FHandle&& Other) noexcept(Q_NOEXCEPT_ENABLED)
+            {
+                if(this != &Other)
+                {
+                    Reset();
+                    Pool = Other.Pool;
+                    Object = Other.Release();
+                }
+                return *this;
+            }
+
+            ~FHandle() noexcept(Q_NOEXCEPT_ENABLED)
+            {
+                Reset();
+            }
+
+            FHandle(const FHandle&)                 = delete;
+            FHandle& operator=(const FHandle&)      = delete;
+
+            FORCEINLINE T* Get() const noexcept(Q_NOEXCEPT_ENABLED)
+            {
+                return Object;
+            }
+
+            FORCEINLINE T* operator->() const noexcept(Q_NOEXCEPT_ENABLED)
+            {
+                return Object;
+            }
+
+            FORCEINLINE T& operator*() const noexcept(Q_NOEXCEPT_ENABLED)
+            {
+                return *Object;
+            }
+
+            FORCEINLINE bool IsValid() const noexcept(Q_NOEXCEPT_ENABLED)
+            {
+                return Object != nullptr;
+            }
+
+            /** Gives up ownership without freeing, e.g. to send the raw pointer through a queue. */
+            FORCEINLINE T* Release() noexcept(Q_NOEXCEPT_ENABLED)
+            {
+                T* Released = Object;
+                Object = nullptr;
+                return Released;
+            }
+
+            FORCEINLINE void Reset() noexcept(Q_NOEXCEPT_ENABLED)
+            {
+                if(Object)
+                {
+                    Pool->Free(Object);
+                    Object = nullptr;
+                }
+            }
+
+        private:
+            TObjectPool*        Pool;
+            T*                  Object;
+        };
+
+        TObjectPool() noexcept(Q_NOEXCEPT_ENABLED)
+            : Arena(static_cast<uint8*>(::operator new(static_cast<size_t>(BlockSize) * TCapacity, std::align_val_t(BlockAlignment)))),
+            Magazines(new FMagazine[TMaxThreads]())
+        {
+            for(uint i = 0; i < TCapacity; ++i)
+            {
+                FreeList.Push(BlockAt(i));
+            }
+            Utils::RegisterThreadSlotListener(this);
+        }
+
+        /** Objects still allocated are not destroyed, their storage goes away with the arena. */
+        ~TObjectPool() noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            Utils::UnregisterThreadSlotListener(this);
+            ::operator delete(Arena, std::align_val_t(BlockAlignment));
+        }
+
+        TObjectPool(const TObjectPool&)                 = delete;
+        TObjectPool& operator=(const TObjectPool&)      = delete;
+
+        FORCEINLINE uint Capacity() const noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            return TCapacity;
+        }
+
+        /** Constructs a T in a free block, or returns nullptr if none is available to this thread. */
+        template<typename... TArgs>
+        FORCEINLINE T* Allocate(TArgs&&... Args)
+        {
+            T* Block = AllocateBlock();
+            return Block ? new(Block) T(std::forward<TArgs>(Args)...) : nullptr;
+        }
+
+        /** Destroys Object and returns its block. Any thread may free objects allocated by any other thread. */
+        FORCEINLINE void Free(T* Object) noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            if(Object)
+            {
+                Object->~T();
+                FreeBlock(Object);
+            }
+        }
+
+        template<typename... TArgs>
+        FORCEINLINE FHandle MakeHandle(TArgs&&... Args)
+        {
+            return FHandle(this, Allocate(std::forward<TArgs>(Args)...));
+        }
+
+        /** Returns the calling thread's cached blocks to the free list now rather than when the thread exits. */
+        void FlushThreadCache() noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            FlushMagazine(Utils::ThreadSlot());
+        }
+
+    private:
+        /* Runs on the exiting thread, so the magazine is still only touched by its owner. */
+        void OnThreadSlotReleased(const uint32 Slot) noexcept override
+        {
+            FlushMagazine(Slot);
+        }
+
+        void FlushMagazine(const uint32 Slot) noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            if(Slot >= TMaxThreads)
+            {
+                return;
+            }
+
+            FMagazine& Magazine = Magazines[Slot];
+            while(Magazine.Count > 0)
+            {
+                FreeList.Push(Magazine.Blocks[--Magazine.Count]);
+            }
+        }
+
+        FORCEINLINE T* BlockAt(const uint Index) const noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            return reinterpret_cast<T*>(Arena + static_cast<size_t>(BlockSize) * Index);
+        }
+
+        FORCEINLINE T* AllocateBlock() noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            T* Block = nullptr;
+            const uint32 ThreadSlot = Utils::ThreadSlot();
+            if(ThreadSlot >= TMaxThreads)
+            {
+                FreeList.TryPop(Block);
+                return Block;
+            }
+
+            FMagazine& Magazine = Magazines[ThreadSlot];
+            if(Magazine.Count == 0)
+            {
+                // Refill only half way, so a thread alternating Allocate and Free doesn't bounce off the free list.
+                while(Magazine.Count < TMagazineSize / 2 && FreeList.TryPop(Block))
+                {
+                    Magazine.Blocks[Magazine.Count++] = Block;
+                }
+                if(Magazine.Count == 0)
+                {
+                    return nullptr;
+                }
+            }
+            return Magazine.Blocks[--Magazine.Count];
+        }
+
+        FORCEINLINE void FreeBlock(T* Block) noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            const uint32 ThreadSlot = Utils::ThreadSlot();
+            if(ThreadSlot >= TMaxThreads)
+            {
+                FreeList.Push(Block);
+                return;
+            }
+
+            // The free list is sized for every block in the pool, so these pushes never wait for room.
+            FMagazine& Magazine = Magazines[ThreadSlot];
+            if(Magazine.Count == TMagazineSize)
+            {
+                while(Magazine.Count > TMagazineSize / 2)
+                {
+                    FreeList.Push(Magazine.Blocks[--Magazine.Count]);
+                }
+            }
+            Magazine.Blocks[Magazine.Count++] = Block;
+        }
+
+        uint8*                          Arena;
+        FFreeList                       FreeList;
+        std::unique_ptr<FMagazine[]>    Magazines;
+    };
+} // AtomicQueue namespace
+
+#undef CACHE_ALIGN
+#undef Q_NOEXCEPT_ENABLED
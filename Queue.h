@@ -1,11 +1,14 @@
 ﻿#pragma once
 
-// #include <cstdio>
+#include <cstdio>
 #include <assert.h>
 #include <cstdlib>
+#include <cstring>
 
 #include <atomic>
+#include <chrono>
 #include <functional>
+#include <type_traits>
 
 // #include <mutex>
 // #include <vector>
@@ -28,7 +31,10 @@ typedef uint64_t    uint64;
 
 typedef unsigned int uint;
 
-#define PLATFORM_CACHE_LINE_SIZE 64
+// Override with -DPLATFORM_CACHE_LINE_SIZE=128 for hardware with 128-byte lines or adjacent-line prefetch.
+#ifndef PLATFORM_CACHE_LINE_SIZE
+    #define PLATFORM_CACHE_LINE_SIZE 64
+#endif
 
 #if defined(_MSC_VER)
     #define SPIN_LOOP_PAUSE()                _mm_pause()
@@ -51,11 +57,26 @@ typedef unsigned int uint;
 #define CACHE_ALIGN alignas(PLATFORM_CACHE_LINE_SIZE)
 #define Q_NOEXCEPT_ENABLED true
 
+// Number of traced queues which get their own sojourn histogram; further traced queues only go to the event log.
+#ifndef QUEUE_TRACE_MAX_QUEUES
+    #define QUEUE_TRACE_MAX_QUEUES 16
+#endif
+
+// Per-thread sojourn event log length, must be a power of two.
+#ifndef QUEUE_TRACE_LOG_SIZE
+    #define QUEUE_TRACE_LOG_SIZE 4096
+#endif
+
+// Threads that can hold a Utils::ThreadSlot at the same time, must be a multiple of 64.
+#ifndef QUEUE_MAX_THREAD_SLOTS
+    #define QUEUE_MAX_THREAD_SLOTS 1024
+#endif
+
 namespace AtomicQueue
 {
     namespace Utils
     {
-        template<uint TElementsPerCacheLine> struct GetCacheLineIndexBits { static int constexpr value = 0; };
+        template<uint TElementsPerCacheLine> struct GetCacheLineIndexBits { static int constexpr Value = 0; };
         template<> struct GetCacheLineIndexBits<256> { static int constexpr Value = 8; };
         template<> struct GetCacheLineIndexBits<128> { static int constexpr Value = 7; };
         template<> struct GetCacheLineIndexBits< 64> { static int constexpr Value = 6; };
@@ -65,7 +86,7 @@ namespace AtomicQueue
         template<> struct GetCacheLineIndexBits<  4> { static int constexpr Value = 2; };
         template<> struct GetCacheLineIndexBits<  2> { static int constexpr Value = 1; };
 
-        template<uint TArraySize, uint TElementsPerCacheLine, bool TUnused = false>
+        template<uint TArraySize, uint TElementsPerCacheLine>
         struct GetIndexShuffleBits
         {
             static constexpr int Bits = GetCacheLineIndexBits<TElementsPerCacheLine>::Value;
@@ -73,8 +94,8 @@ namespace AtomicQueue
             static constexpr int Value = TArraySize < MinSize ? 0 : Bits;
         };
 
-        template<uint TArraySize, uint TElementsPerCacheLine>
-        struct GetIndexShuffleBits<TArraySize, TElementsPerCacheLine>
+        template<uint TArraySize>
+        struct GetIndexShuffleBits<TArraySize, 1>
         {
             static constexpr int Value = 0;
         };
@@ -134,10 +155,534 @@ namespace AtomicQueue
 
         constexpr std::memory_order ACQUIRE     = std::memory_order_acquire;
         constexpr std::memory_order RELEASE     = std::memory_order_release;
+        constexpr std::memory_order ACQ_REL     = std::memory_order_acq_rel;
         constexpr std::memory_order RELAXED     = std::memory_order_relaxed;
         constexpr std::memory_order SEQ_CONST   = std::memory_order_seq_cst;
+
+        /** SPIN_LOOP_PAUSE for code built on top of this header, which only sees the macro undefined. */
+        FORCEINLINE void SpinLoopPause() noexcept
+        {
+            SPIN_LOOP_PAUSE();
+        }
+
+        static constexpr uint32 InvalidThreadSlot = ~0U;
+
+        static_assert(QUEUE_MAX_THREAD_SLOTS % 64 == 0, "Thread slots must be a multiple of 64!");
+
+        /**
+         * Per-thread state keyed by ThreadSlot derives from this to learn when a slot's thread exits. Derived
+         * types call RegisterThreadSlotListener once fully constructed and UnregisterThreadSlotListener first
+         * thing in their destructor.
+         */
+        class FThreadSlotListener
+        {
+        public:
+            /** Called on the exiting thread, before Slot can be handed to another thread. */
+            virtual void OnThreadSlotReleased(const uint32 Slot) noexcept = 0;
+
+        protected:
+            ~FThreadSlotListener() = default;
+
+        private:
+            friend struct FThreadSlotRegistry;
+
+            FThreadSlotListener*    PrevListener = nullptr;
+            FThreadSlotListener*    NextListener = nullptr;
+        };
+
+        /** Slots in use and the listeners to notify, zero-initialized static storage so it outlives every thread. */
+        struct FThreadSlotRegistry
+        {
+            std::atomic<uint64>     UsedSlots[QUEUE_MAX_THREAD_SLOTS / 64];
+            std::atomic<bool>       bListenersLocked;
+            FThreadSlotListener*    Listeners;
+
+            static FThreadSlotRegistry& Get() noexcept
+            {
+                static FThreadSlotRegistry Registry;
+                return Registry;
+            }
+
+            /** Takes the lowest free slot, so slot numbers stay as dense as the set of live threads. */
+            uint32 Acquire() noexcept
+            {
+                for(uint32 Word = 0; Word < QUEUE_MAX_THREAD_SLOTS / 64; ++Word)
+                {
+                    uint64 Used = UsedSlots[Word].load(RELAXED);
+                    while(Used != ~0ULL)
+                    {
+                        uint32 Bit = 0;
+                        while(Used & (1ULL << Bit))
+                        {
+                            ++Bit;
+                        }
+                        if(UsedSlots[Word].compare_exchange_weak(Used, Used | (1ULL << Bit), ACQUIRE, RELAXED))
+                        {
+                            return Word * 64 + Bit;
+                        }
+                    }
+                }
+                return InvalidThreadSlot;
+            }
+
+            void Release(const uint32 Slot) noexcept
+            {
+                Lock();
+                for(FThreadSlotListener* Listener = Listeners; Listener; Listener = Listener->NextListener)
+                {
+                    Listener->OnThreadSlotReleased(Slot);
+                }
+                Unlock();
+
+                // Hands the listeners' cleanup to whichever thread takes the slot next.
+                UsedSlots[Slot / 64].fetch_and(~(1ULL << (Slot % 64)), RELEASE);
+            }
+
+            void AddListener(FThreadSlotListener* Listener) noexcept
+            {
+                Lock();
+                Listener->PrevListener = nullptr;
+                Listener->NextListener = Listeners;
+                if(Listeners)
+                {
+                    Listeners->PrevListener = Listener;
+                }
+                Listeners = Listener;
+                Unlock();
+            }
+
+            void RemoveListener(FThreadSlotListener* Listener) noexcept
+            {
+                Lock();
+                if(Listener->PrevListener)
+                {
+                    Listener->PrevListener->NextListener = Listener->NextListener;
+                }
+                else
+                {
+                    Listeners = Listener->NextListener;
+                }
+                if(Listener->NextListener)
+                {
+                    Listener->NextListener->PrevListener = Listener->PrevListener;
+                }
+                Unlock();
+            }
+
+        private:
+            /* Only taken when a thread exits or a listener comes or goes, never on a queue operation. */
+            void Lock() noexcept
+            {
+                while(bListenersLocked.exchange(true, ACQUIRE))
+                {
+                    SpinLoopPause();
+                }
+            }
+
+            void Unlock() noexcept
+            {
+                bListenersLocked.store(false, RELEASE);
+            }
+        };
+
+        struct FThreadSlotHolder
+        {
+            const uint32 Slot;
+
+            ~FThreadSlotHolder() noexcept
+            {
+                if(Slot != InvalidThreadSlot)
+                {
+                    FThreadSlotRegistry::Get().Release(Slot);
+                }
+            }
+        };
+
+        /**
+         * Dense index of the calling thread among live threads, taken on first use and handed back when the thread
+         * exits, after every FThreadSlotListener has been told. InvalidThreadSlot if QUEUE_MAX_THREAD_SLOTS threads
+         * already hold one.
+         */
+        inline uint32 ThreadSlot() noexcept
+        {
+            static thread_local const FThreadSlotHolder Holder{FThreadSlotRegistry::Get().Acquire()};
+            return Holder.Slot;
+        }
+
+        inline void RegisterThreadSlotListener(FThreadSlotListener* Listener) noexcept
+        {
+            FThreadSlotRegistry::Get().AddListener(Listener);
+        }
+
+        inline void UnregisterThreadSlotListener(FThreadSlotListener* Listener) noexcept
+        {
+            FThreadSlotRegistry::Get().RemoveListener(Listener);
+        }
     } // namespace Utils
 
+    /**
+     * Opt-in enqueue-to-dequeue (sojourn) time tracing, enabled per queue with the TTrace template parameter.
+     *
+     * A sampled subset of elements is stamped on Push and measured on Pop. Samples are recorded by the popping
+     * thread into its own histogram and event log, which only that thread writes, so recording needs no
+     * RMW operations. Queues with TTrace == false carry no trace state and compile the hooks out.
+     */
+    namespace Trace
+    {
+        static constexpr uint32 HistogramLinearBuckets  = 16;
+        static constexpr uint32 HistogramSubBucketBits  = 2;
+        static constexpr uint32 HistogramMaxExponent    = 43;
+        static constexpr uint32 HistogramBucketCount    = HistogramLinearBuckets
+            + (HistogramMaxExponent - 3) * (1U << HistogramSubBucketBits);
+        static constexpr uint32 SamplerRecheckInterval  = 1024;
+
+        static_assert((QUEUE_TRACE_LOG_SIZE & (QUEUE_TRACE_LOG_SIZE - 1)) == 0, "Trace log size must be a power of two!");
+
+        struct FEvent
+        {
+            std::atomic<uint64>     PushTime;
+            std::atomic<uint64>     PopTime;
+            std::atomic<uint32>     QueueId;
+        };
+
+        /**
+         * Sojourn samples recorded by one popping thread. Allocated on the first sample and never freed, so the
+         * data is still there to dump after the thread exits.
+         */
+        struct FThreadLog
+        {
+            std::atomic<uint64>     Histogram[QUEUE_TRACE_MAX_QUEUES][HistogramBucketCount];
+            FEvent                  Events[QUEUE_TRACE_LOG_SIZE];
+            std::atomic<uint64>     EventCount;
+            uint32                  ThreadIndex;
+            FThreadLog*             Next;
+        };
+
+        FORCEINLINE uint64 Now() noexcept
+        {
+            // Zero marks an unsampled slot, so never hand it out as a timestamp.
+            return static_cast<uint64>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count()) | 1;
+        }
+
+        FORCEINLINE std::atomic<uint32>& SamplePeriod() noexcept
+        {
+            static std::atomic<uint32> Period{0};
+            return Period;
+        }
+
+        FORCEINLINE std::atomic<uint32>& QueueCount() noexcept
+        {
+            static std::atomic<uint32> Count{0};
+            return Count;
+        }
+
+        FORCEINLINE std::atomic<const char*>* QueueNames() noexcept
+        {
+            static std::atomic<const char*> Names[QUEUE_TRACE_MAX_QUEUES] = {};
+            return Names;
+        }
+
+        FORCEINLINE std::atomic<FThreadLog*>& ThreadLogs() noexcept
+        {
+            static std::atomic<FThreadLog*> Head{nullptr};
+            return Head;
+        }
+
+        /**
+         * Sets the fraction of pushes that get stamped, e.g. 0.01 for 1%. Zero turns sampling off.
+         * Threads pick up a new rate within SamplerRecheckInterval pushes.
+         */
+        inline void SetSampleRate(const double Fraction) noexcept
+        {
+            SamplePeriod().store(Fraction > 0.0
+                ? static_cast<uint32>(Fraction >= 1.0 ? 1.0 : 1.0 / Fraction + 0.5) : 0, Utils::RELAXED);
+        }
+
+        /** Per-thread countdown, so an unsampled push costs one thread local decrement. */
+        FORCEINLINE bool ShouldSample() noexcept
+        {
+            static thread_local uint32 Countdown = 1;
+            if(--Countdown != 0)
+            {
+                return false;
+            }
+            const uint32 Period = SamplePeriod().load(Utils::RELAXED);
+            Countdown = Period ? Period : SamplerRecheckInterval;
+            return Period != 0;
+        }
+
+        inline uint32 RegisterQueue() noexcept
+        {
+            return QueueCount().fetch_add(1, Utils::RELAXED);
+        }
+
+        inline void SetQueueName(const uint32 QueueId, const char* Name) noexcept
+        {
+            if(QueueId < QUEUE_TRACE_MAX_QUEUES)
+            {
+                QueueNames()[QueueId].store(Name, Utils::RELEASE);
+            }
+        }
+
+        constexpr uint32 HistogramBucket(const uint64 Duration) noexcept
+        {
+            uint32 Exponent = 0;
+            for(uint64 Value = Duration; Value > 1; Value >>= 1)
+            {
+                ++Exponent;
+            }
+            return Duration < HistogramLinearBuckets ? static_cast<uint32>(Duration)
+                : Exponent >= HistogramMaxExponent ? HistogramBucketCount - 1
+                : HistogramLinearBuckets + ((Exponent - 4) << HistogramSubBucketBits)
+                    + static_cast<uint32>((Duration >> (Exponent - HistogramSubBucketBits)) & ((1U << HistogramSubBucketBits) - 1));
+        }
+
+        /** Smallest duration which lands in Bucket. */
+        constexpr uint64 HistogramBucketValue(const uint32 Bucket) noexcept
+        {
+            return Bucket < HistogramLinearBuckets ? Bucket
+                : static_cast<uint64>((1U << HistogramSubBucketBits) + ((Bucket - HistogramLinearBuckets) & ((1U << HistogramSubBucketBits) - 1)))
+                    << (((Bucket - HistogramLinearBuckets) >> HistogramSubBucketBits) + 4 - HistogramSubBucketBits);
+        }
+
+        inline FThreadLog* RegisterThreadLog() noexcept
+        {
+            FThreadLog* Log = static_cast<FThreadLog*>(calloc(1, sizeof(FThreadLog)));
+            assert(Log);
+
+            static std::atomic<uint32> ThreadCount{0};
+            Log->ThreadIndex = ThreadCount.fetch_add(1, Utils::RELAXED);
+
+            FThreadLog* Head = ThreadLogs().load(Utils::RELAXED);
+            do
+            {
+                Log->Next = Head;
+            }
+            while(!ThreadLogs().compare_exchange_weak(Head, Log, Utils::RELEASE, Utils::RELAXED));
+            return Log;
+        }
+
+        inline void Record(const uint32 QueueId, const uint64 PushTime, const uint64 PopTime) noexcept
+        {
+            static thread_local FThreadLog* Log = nullptr;
+            if(!Log)
+            {
+                Log = RegisterThreadLog();
+            }
+
+            // Only this thread writes its log, plain load/store pairs are enough for the dump to read it.
+            const uint64 Duration = PopTime > PushTime ? PopTime - PushTime : 0;
+            if(QueueId < QUEUE_TRACE_MAX_QUEUES)
+            {
+                std::atomic<uint64>& Counter = Log->Histogram[QueueId][HistogramBucket(Duration)];
+                Counter.store(Counter.load(Utils::RELAXED) + 1, Utils::RELAXED);
+            }
+
+            const uint64 EventIndex = Log->EventCount.load(Utils::RELAXED);
+            FEvent& Event = Log->Events[EventIndex & (QUEUE_TRACE_LOG_SIZE - 1)];
+            Event.PushTime.store(PushTime, Utils::RELAXED);
+            Event.PopTime.store(PopTime, Utils::RELAXED);
+            Event.QueueId.store(QueueId, Utils::RELAXED);
+            Log->EventCount.store(EventIndex + 1, Utils::RELEASE);
+        }
+
+        /** Writes QueueId's name, or "Queue N" if it has none. bEscapeJson escapes it for a JSON string. */
+        inline void WriteQueueName(FILE* Out, const uint32 QueueId, const bool bEscapeJson) noexcept
+        {
+            const char* Name = QueueId < QUEUE_TRACE_MAX_QUEUES ? QueueNames()[QueueId].load(Utils::ACQUIRE) : nullptr;
+            if(!Name)
+            {
+                fprintf(Out, "Queue %u", QueueId);
+                return;
+            }
+            for(; *Name; ++Name)
+            {
+                if(bEscapeJson && (*Name == '"' || *Name == '\\'))
+                {
+                    fputc('\\', Out);
+                }
+                fputc(*Name, Out);
+            }
+        }
+
+        /**
+         * Writes the most recent QUEUE_TRACE_LOG_SIZE samples of every thread as Chrome trace_event JSON,
+         * one complete event per sample spanning Push to Pop. Load the file in chrome://tracing or Perfetto.
+         * Samples recorded while the dump runs may come out torn, dump once the queues are quiet.
+         */
+        inline bool WriteChromeTrace(const char* Path) noexcept
+        {
+            FILE* Out = fopen(Path, "w");
+            if(!Out)
+            {
+                return false;
+            }
+
+            fprintf(Out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+            bool bFirstEvent = true;
+            for(FThreadLog* Log = ThreadLogs().load(Utils::ACQUIRE); Log; Log = Log->Next)
+            {
+                const uint64 EventCount = Log->EventCount.load(Utils::ACQUIRE);
+                const uint64 FirstEvent = EventCount > QUEUE_TRACE_LOG_SIZE ? EventCount - QUEUE_TRACE_LOG_SIZE : 0;
+                for(uint64 i = FirstEvent; i < EventCount; ++i)
+                {
+                    const FEvent& Event = Log->Events[i & (QUEUE_TRACE_LOG_SIZE - 1)];
+                    const uint64 PushTime = Event.PushTime.load(Utils::RELAXED);
+                    const uint64 PopTime = Event.PopTime.load(Utils::RELAXED);
+
+                    fprintf(Out, "%s\n{\"name\":\"", bFirstEvent ? "" : ",");
+                    WriteQueueName(Out, Event.QueueId.load(Utils::RELAXED), true);
+                    fprintf(Out, "\",\"cat\":\"sojourn\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                        Log->ThreadIndex, PushTime / 1000.0, (PopTime > PushTime ? PopTime - PushTime : 0) / 1000.0);
+                    bFirstEvent = false;
+                }
+            }
+            fprintf(Out, "\n]}\n");
+
+            return fclose(Out) == 0;
+        }
+
+        /** Writes sample count and p50/p90/p99/p99.9/max sojourn time per traced queue, merged over all threads. */
+        inline void WriteSummary(FILE* Out) noexcept
+        {
+            static constexpr double Percentiles[] = {0.5, 0.9, 0.99, 0.999};
+
+            const uint32 TracedQueues = QueueCount().load(Utils::RELAXED);
+            for(uint32 QueueId = 0; QueueId < TracedQueues && QueueId < QUEUE_TRACE_MAX_QUEUES; ++QueueId)
+            {
+                uint64 Histogram[HistogramBucketCount] = {};
+                uint64 SampleCount = 0;
+                for(FThreadLog* Log = ThreadLogs().load(Utils::ACQUIRE); Log; Log = Log->Next)
+                {
+                    for(uint32 Bucket = 0; Bucket < HistogramBucketCount; ++Bucket)
+                    {
+                        const uint64 Count = Log->Histogram[QueueId][Bucket].load(Utils::RELAXED);
+                        Histogram[Bucket] += Count;
+                        SampleCount += Count;
+                    }
+                }
+
+                WriteQueueName(Out, QueueId, false);
+                fprintf(Out, ": samples=%llu", static_cast<unsigned long long>(SampleCount));
+                if(SampleCount == 0)
+                {
+                    fprintf(Out, "\n");
+                    continue;
+                }
+
+                uint32 Bucket = 0;
+                uint64 Seen = Histogram[0];
+                for(const double Percentile : Percentiles)
+                {
+                    while(Seen < static_cast<uint64>(Percentile * SampleCount) + 1 && Bucket + 1 < HistogramBucketCount)
+                    {
+                        Seen += Histogram[++Bucket];
+                    }
+                    fprintf(Out, " p%g=%lluns", Percentile * 100.0, static_cast<unsigned long long>(HistogramBucketValue(Bucket)));
+                }
+
+                uint32 MaxBucket = HistogramBucketCount - 1;
+                while(Histogram[MaxBucket] == 0)
+                {
+                    --MaxBucket;
+                }
+                fprintf(Out, " max=%lluns\n", static_cast<unsigned long long>(HistogramBucketValue(MaxBucket)));
+            }
+        }
+
+        /**
+         * Per-queue stamp storage. The stamp carries the ticket of the element it was taken for, so a Pop only
+         * measures the sample that belongs to its own ticket, even if the slot has been reused since.
+         *
+         * Push stamps before waiting for its slot, so on a full queue a producer one lap ahead reaches the stamp
+         * while the element it belongs to is still queued. Push therefore claims a free stamp by CAS and the
+         * matching Pop frees it again, a push finding the stamp taken goes unsampled instead of overwriting it.
+         */
+        template<uint TSlotCount, bool TTrace>
+        class TSojournStamps
+        {
+        public:
+            FORCEINLINE void OnPush(const uint) noexcept {}
+            FORCEINLINE void OnPop(const uint) noexcept {}
+            FORCEINLINE void SetName(const char*) noexcept {}
+        };
+
+        template<uint TSlotCount>
+        class TSojournStamps<TSlotCount, true>
+        {
+            static_assert((TSlotCount & (TSlotCount - 1)) == 0, "Slot count must be a power of two!");
+
+            static constexpr uint32 FreeTicket      = 0;
+            static constexpr uint32 WritingTicket   = ~0U;
+
+            struct FStamp
+            {
+                std::atomic<uint64>     PushTime;
+                std::atomic<uint32>     Ticket;
+            };
+
+            FStamp*         Stamps;
+            uint32          QueueId;
+
+        public:
+            TSojournStamps() noexcept
+                : Stamps(static_cast<FStamp*>(calloc(TSlotCount, sizeof(FStamp)))),
+                QueueId(RegisterQueue())
+            {
+                assert(Stamps);
+            }
+
+            ~TSojournStamps() noexcept
+            {
+                free(Stamps);
+            }
+
+            TSojournStamps(const TSojournStamps&)               = delete;
+            TSojournStamps& operator=(const TSojournStamps&)    = delete;
+
+            FORCEINLINE void OnPush(const uint Ticket) noexcept
+            {
+                if(ShouldSample() && IsTaggable(Ticket))
+                {
+                    // Acquire pairs with the Pop that freed the stamp, so its read of PushTime is done.
+                    FStamp& Stamp = Stamps[Ticket & (TSlotCount - 1)];
+                    uint32 Expected = FreeTicket;
+                    if(Stamp.Ticket.load(Utils::RELAXED) == FreeTicket
+                        && Stamp.Ticket.compare_exchange_strong(Expected, WritingTicket, Utils::ACQUIRE, Utils::RELAXED))
+                    {
+                        Stamp.PushTime.store(Now(), Utils::RELAXED);
+                        Stamp.Ticket.store(Ticket + 1, Utils::RELEASE);
+                    }
+                }
+            }
+
+            /* Only the Pop of the stamp's own ticket frees it, so nothing else writes the stamp while it is read. */
+            FORCEINLINE void OnPop(const uint Ticket) noexcept
+            {
+                FStamp& Stamp = Stamps[Ticket & (TSlotCount - 1)];
+                if(IsTaggable(Ticket) && Stamp.Ticket.load(Utils::ACQUIRE) == Ticket + 1)
+                {
+                    const uint64 PushTime = Stamp.PushTime.load(Utils::RELAXED);
+                    Stamp.Ticket.store(FreeTicket, Utils::RELEASE);
+                    Record(QueueId, PushTime, Now());
+                }
+            }
+
+            void SetName(const char* Name) noexcept
+            {
+                SetQueueName(QueueId, Name);
+            }
+
+        private:
+            /** Stamps are tagged Ticket + 1, the two tickets whose tag would read as a marker are never sampled. */
+            static FORCEINLINE bool IsTaggable(const uint Ticket) noexcept
+            {
+                return Ticket + 1 != FreeTicket && Ticket + 1 != WritingTicket;
+            }
+        };
+    } // namespace Trace
+
 /**
  * @biref Common base type for creating bounded queues.
  */
@@ -164,7 +709,7 @@ public:
         : ProducerCursor{InProducerCursor},
         ConsumerCursor{InConsumerCursor}
     {
-        assert(InProducerCursor > InConsumerCursor);
+        assert(InProducerCursor >= InConsumerCursor);
     }
     
     virtual ~TBoundedQueueCommon() noexcept(Q_NOEXCEPT_ENABLED) = default;
@@ -182,7 +727,7 @@ public:
         return *this;
     }
 
-    void Swap(const TBoundedQueueCommon& Other) noexcept(Q_NOEXCEPT_ENABLED)
+    void Swap(TBoundedQueueCommon& Other) noexcept(Q_NOEXCEPT_ENABLED)
     {
         const uint ThisProducerCursor = ProducerCursor.load(Utils::RELAXED);
         const uint ThisConsumerCursor = ConsumerCursor.load(Utils::RELAXED);
@@ -219,33 +764,106 @@ protected:
         return ConsumerCursor.fetch_add(1, FetchAddMemoryOrder);
     }
 
-    FORCEINLINE bool TryPushBase(const std::function<void()>& DerivedPushFunction) noexcept(Q_NOEXCEPT_ENABLED)
+    /**
+     * Claims a producer cursor only if the queue has room for it and its slot is already empty, so TryPush doesn't
+     * wait on a consumer that claimed the slot but hasn't taken its element yet. The cursor differences are signed
+     * because consumers doing Pop on an empty queue move ConsumerCursor past ProducerCursor.
+     *
+     * This and TryPopBase narrow waiting to a race rather than rule it out: the slot state carries no lap, so a
+     * slot that changes hands between the check and the claim can still make a successful Try* wait.
+     */
+    template<bool TSPSC, typename TSlotCheckFunction, typename TDerivedPushFunction>
+    FORCEINLINE bool TryPushBase(const TSlotCheckFunction& IsSlotEmpty,
+        const TDerivedPushFunction& DerivedPushFunction) noexcept(Q_NOEXCEPT_ENABLED)
     {
-        if(this->IsFull())
+        uint Cursor = ProducerCursor.load(Utils::RELAXED);
+        for(;;)
         {
-            return false;
+            if(static_cast<int>(Cursor - ConsumerCursor.load(Utils::RELAXED)) >= static_cast<int>(RoundedSize))
+            {
+                return false;
+            }
+            if(!IsSlotEmpty(Cursor))
+            {
+                // Either another producer took this cursor already, or a consumer is still emptying the slot.
+                const uint CurrentCursor = ProducerCursor.load(Utils::RELAXED);
+                if(CurrentCursor == Cursor)
+                {
+                    return false;
+                }
+                Cursor = CurrentCursor;
+                continue;
+            }
+            if(TSPSC)
+            {
+                ProducerCursor.store(Cursor + 1, Utils::RELAXED);
+                break;
+            }
+            if(ProducerCursor.compare_exchange_weak(Cursor, Cursor + 1, FetchAddMemoryOrder, Utils::RELAXED))
+            {
+                break;
+            }
         }
-        DerivedPushFunction();
+        DerivedPushFunction(Cursor);
         return true;
     }
 
-    FORCEINLINE bool TryPopBase(const std::function<void()>& DerivedPopFunction) noexcept(Q_NOEXCEPT_ENABLED)
+    /**
+     * Claims a consumer cursor only if it has been handed out to a producer and its slot already holds an element,
+     * so TryPop doesn't wait on a producer that claimed the cursor but hasn't stored yet.
+     */
+    template<bool TSPSC, typename TSlotCheckFunction, typename TDerivedPopFunction>
+    FORCEINLINE bool TryPopBase(const TSlotCheckFunction& IsSlotFull,
+        const TDerivedPopFunction& DerivedPopFunction) noexcept(Q_NOEXCEPT_ENABLED)
     {
-        if(this->IsEmpty())
+        uint Cursor = ConsumerCursor.load(Utils::RELAXED);
+        for(;;)
         {
-            return false;
+            if(static_cast<int>(ProducerCursor.load(Utils::RELAXED) - Cursor) <= 0)
+            {
+                return false;
+            }
+            if(!IsSlotFull(Cursor))
+            {
+                // Either another consumer took this cursor already, or its producer is still storing.
+                const uint CurrentCursor = ConsumerCursor.load(Utils::RELAXED);
+                if(CurrentCursor == Cursor)
+                {
+                    return false;
+                }
+                Cursor = CurrentCursor;
+                continue;
+            }
+            if(TSPSC)
+            {
+                ConsumerCursor.store(Cursor + 1, Utils::RELAXED);
+                break;
+            }
+            if(ConsumerCursor.compare_exchange_weak(Cursor, Cursor + 1, FetchAddMemoryOrder, Utils::RELAXED))
+            {
+                break;
+            }
         }
-        DerivedPopFunction();
+        DerivedPopFunction(Cursor);
         return true;
     }
     
 public:
     virtual FORCEINLINE void Push(const FElementType& NewElement) noexcept(Q_NOEXCEPT_ENABLED)              = 0;
     virtual FORCEINLINE FElementType Pop() noexcept(Q_NOEXCEPT_ENABLED)                                     = 0;
-    virtual FORCEINLINE void PushLowPriority(const FElementType& NewElement) noexcept(Q_NOEXCEPT_ENABLED)   = 0;
-    virtual FORCEINLINE FElementType PopLowPriority() noexcept(Q_NOEXCEPT_ENABLED)                          = 0;
     virtual FORCEINLINE bool TryPush(const FElementType& NewElement) noexcept(Q_NOEXCEPT_ENABLED)           = 0;
     virtual FORCEINLINE bool TryPop(FElementType& OutElement) noexcept(Q_NOEXCEPT_ENABLED)                  = 0;
+
+    /* No queue type has a dedicated low priority path yet, so these share the regular one. */
+    virtual FORCEINLINE void PushLowPriority(const FElementType& NewElement) noexcept(Q_NOEXCEPT_ENABLED)
+    {
+        Push(NewElement);
+    }
+
+    virtual FORCEINLINE FElementType PopLowPriority() noexcept(Q_NOEXCEPT_ENABLED)
+    {
+        return Pop();
+    }
     
     FORCEINLINE uint Size() const noexcept(Q_NOEXCEPT_ENABLED)
     {
@@ -273,21 +891,6 @@ public:
         return Difference > 0 ? Difference : 0;
     }
 
-private:
-    FORCEINLINE bool IsFull() const noexcept(Q_NOEXCEPT_ENABLED)
-    {
-        const uint CurrentProducerCursor = ProducerCursor.load(Utils::ACQUIRE);
-        const uint CurrentConsumerCursor = ConsumerCursor.load(Utils::ACQUIRE);
-        return (CurrentProducerCursor + 1) == CurrentConsumerCursor;
-    }
-
-    FORCEINLINE bool IsEmpty() const noexcept(Q_NOEXCEPT_ENABLED)
-    {
-        const uint CurrentProducerCursor = ProducerCursor.load(Utils::ACQUIRE);
-        const uint CurrentConsumerCursor = ConsumerCursor.load(Utils::ACQUIRE);
-        return CurrentProducerCursor == CurrentConsumerCursor;
-    }
-        
 
 protected:
     CACHE_ALIGN std::atomic<uint>   ProducerCursor;
@@ -321,6 +924,11 @@ protected:
     static constexpr uint               IndexMask = TQueueBaseType::IndexMask;
     
 public:
+    using TElementType = FElementType;
+
+    /** Push and TryPush claim the producer cursor with a seq_cst RMW, which also orders the element before later loads. */
+    static constexpr bool bTotalOrderPush = TTotalOrder && !TSPSC;
+    
     TBoundedCircularQueueBase() noexcept
         : TQueueBaseType()
     {
@@ -359,6 +967,7 @@ protected:
             }
             QueueIndex = NewElement;
             State.store(EBufferNodeState::FULL, Utils::RELEASE);
+            return;
         }
         
         /* Likely to succeed on first iteration. */
@@ -408,8 +1017,9 @@ protected:
                 Expected, EBufferNodeState::LOADING,
                 Utils::ACQUIRE, Utils::RELAXED))
             {
+                const FElementType Element = QueueIndex;
                 State.store(EBufferNodeState::EMPTY, Utils::RELEASE);
-                return QueueIndex;
+                return Element;
             }
 
             // Do speculative loads while busy-waiting to avoid broadcasting RFO messages.
@@ -425,7 +1035,7 @@ protected:
 /**
  * Bounded circular queue for non-atomic elements.
  */
-template<typename T, uint TQueueSize, bool TTotalOrder = true, bool TMaxThroughput = true, bool TSPSC = false>
+template<typename T, uint TQueueSize, bool TTotalOrder = true, bool TMaxThroughput = true, bool TSPSC = false, bool TTrace = false, int TShuffleBits = -1>
 class CACHE_ALIGN TBoundedCircularQueue : public TBoundedCircularQueueBase<T, TQueueSize, TTotalOrder, TMaxThroughput, TSPSC>
 {
     using TQueueBaseTypeCommon  = TBoundedQueueCommon<T, TQueueSize, TTotalOrder>;
@@ -436,14 +1046,20 @@ class CACHE_ALIGN TBoundedCircularQueue : public TBoundedCircularQueueBase<T, TQ
     static constexpr uint                       TypeSize = TQueueBaseType::TypeSize;
     static constexpr uint                       StateSize = TQueueBaseType::StateSize;
     static constexpr uint                       RoundedSize = TQueueBaseType::RoundedSize;
-    static constexpr int                        ShuffleBits = Utils::GetIndexShuffleBits<TQueueSize,
-                                                    PLATFORM_CACHE_LINE_SIZE / StateSize>::Value;
+    static constexpr int                        ShuffleBits = TShuffleBits >= 0 ? TShuffleBits
+                                                    : Utils::GetIndexShuffleBits<RoundedSize, PLATFORM_CACHE_LINE_SIZE / StateSize>::Value;
     static constexpr uint                       IndexMask = TQueueBaseType::IndexMask;
 
+    static_assert(ShuffleBits >= 0 && (1ULL << (ShuffleBits * 2)) <= RoundedSize,  "Shuffle bits need a larger queue!");
+
     CACHE_ALIGN FElementType                    CircularBuffer[RoundedSize];
     CACHE_ALIGN std::atomic<EBufferNodeState>   CircularBufferStates[RoundedSize];
+    Trace::TSojournStamps<RoundedSize, TTrace>  SojournStamps;
 
 public:
+    /** Bits of the cursor swapped by Utils::RemapCursor, from TShuffleBits or derived from the cache line size if it is negative. */
+    static constexpr int IndexShuffleBits = ShuffleBits;
+
     TBoundedCircularQueue() noexcept
         : TQueueBaseType(),
         CircularBuffer{},
@@ -458,30 +1074,62 @@ public:
     
     virtual FORCEINLINE void Push(const FElementType& NewElement) noexcept(Q_NOEXCEPT_ENABLED) override
     {
-        const uint ThisIndex = TQueueBaseType::template IncrementProducerCursor<TSPSC>();
-        const uint Index = Utils::RemapCursor<ShuffleBits>(ThisIndex & IndexMask);
-        TQueueBaseType::PushBase(NewElement, CircularBufferStates[Index], CircularBuffer[Index]);
+        PushAtCursor(TQueueBaseType::template IncrementProducerCursor<TSPSC>(), NewElement);
     }
     
     virtual FORCEINLINE FElementType Pop() noexcept(Q_NOEXCEPT_ENABLED) override
     {
-        const uint ThisIndex = TQueueBaseType::template IncrementConsumerCursor<TSPSC>();
-        const uint Index = Utils::RemapCursor<ShuffleBits>(ThisIndex & IndexMask);
-        return TQueueBaseType::PopBase(CircularBufferStates[Index], CircularBuffer[Index]);
+        return PopAtCursor(TQueueBaseType::template IncrementConsumerCursor<TSPSC>());
     }
     
     virtual FORCEINLINE bool TryPush(const FElementType& NewElement) noexcept(Q_NOEXCEPT_ENABLED) override
     {
-        return TQueueBaseTypeCommon::TryPushBase([this, &NewElement](){ Push(NewElement); });
+        return TQueueBaseTypeCommon::template TryPushBase<TSPSC>(
+            [this](const uint ThisIndex){ return SlotStateAtCursor(ThisIndex) == EBufferNodeState::EMPTY; },
+            [this, &NewElement](const uint ThisIndex){ PushAtCursor(ThisIndex, NewElement); });
     }
     
     virtual FORCEINLINE bool TryPop(FElementType& OutElement) noexcept(Q_NOEXCEPT_ENABLED) override
     {
-        return TQueueBaseTypeCommon::TryPopBase([this, &OutElement](){ OutElement = Pop(); });
+        return TQueueBaseTypeCommon::template TryPopBase<TSPSC>(
+            [this](const uint ThisIndex){ return SlotStateAtCursor(ThisIndex) == EBufferNodeState::FULL; },
+            [this, &OutElement](const uint ThisIndex){ OutElement = PopAtCursor(ThisIndex); });
+    }
+
+    /** Names this queue in sojourn trace dumps, Name must outlive the dump. No-op unless TTrace. */
+    void SetTraceName(const char* Name) noexcept
+    {
+        SojournStamps.SetName(Name);
+    }
+private:
+    FORCEINLINE EBufferNodeState SlotStateAtCursor(const uint ThisIndex) const noexcept(Q_NOEXCEPT_ENABLED)
+    {
+        return CircularBufferStates[Utils::RemapCursor<ShuffleBits>(ThisIndex & IndexMask)].load(Utils::ACQUIRE);
+    }
+
+    FORCEINLINE void PushAtCursor(const uint ThisIndex, const FElementType& NewElement) noexcept(Q_NOEXCEPT_ENABLED)
+    {
+        const uint Index = Utils::RemapCursor<ShuffleBits>(ThisIndex & IndexMask);
+        if(TTrace)
+        {
+            SojournStamps.OnPush(ThisIndex);
+        }
+        TQueueBaseType::PushBase(NewElement, CircularBufferStates[Index], CircularBuffer[Index]);
+    }
+
+    FORCEINLINE FElementType PopAtCursor(const uint ThisIndex) noexcept(Q_NOEXCEPT_ENABLED)
+    {
+        const uint Index = Utils::RemapCursor<ShuffleBits>(ThisIndex & IndexMask);
+        const FElementType Element = TQueueBaseType::PopBase(CircularBufferStates[Index], CircularBuffer[Index]);
+        if(TTrace)
+        {
+            SojournStamps.OnPop(ThisIndex);
+        }
+        return Element;
     }
 };
 
-template<typename T, uint TQueueSize, T TNil = T{}, bool TTotalOrder = true, bool TMaxThroughput = true, bool TSPSC = false>
+template<typename T, uint TQueueSize, T TNil = T{}, bool TTotalOrder = true, bool TMaxThroughput = true, bool TSPSC = false, bool TTrace = false, int TShuffleBits = -1>
 class CACHE_ALIGN TBoundedCircularQueueHeap : public TBoundedCircularQueueBase<T, TQueueSize, TTotalOrder, TMaxThroughput, TSPSC>
 {
     using TQueueBaseTypeCommon  = TBoundedQueueCommon<T, TQueueSize, TTotalOrder>;
@@ -492,14 +1140,20 @@ class CACHE_ALIGN TBoundedCircularQueueHeap : public TBoundedCircularQueueBase<T
     static constexpr uint                       TypeSize = TQueueBaseType::TypeSize;
     static constexpr uint                       StateSize = TQueueBaseType::StateSize;
     static constexpr uint                       RoundedSize = TQueueBaseType::RoundedSize;
-    static constexpr int                        ShuffleBits = Utils::GetCacheLineIndexBits<
-                                                    PLATFORM_CACHE_LINE_SIZE / StateSize>::Value;
+    static constexpr int                        ShuffleBits = TShuffleBits >= 0 ? TShuffleBits
+                                                    : Utils::GetIndexShuffleBits<RoundedSize, PLATFORM_CACHE_LINE_SIZE / StateSize>::Value;
     static constexpr uint                       IndexMask = TQueueBaseType::IndexMask;
+
+    static_assert(ShuffleBits >= 0 && (1ULL << (ShuffleBits * 2)) <= RoundedSize,  "Shuffle bits need a larger queue!");
     
     CACHE_ALIGN FElementType                    *CircularBuffer;
     CACHE_ALIGN std::atomic<EBufferNodeState>   *CircularBufferStates;
+    Trace::TSojournStamps<RoundedSize, TTrace>  SojournStamps;
     
 public:
+    /** Bits of the cursor swapped by Utils::RemapCursor, from TShuffleBits or derived from the cache line size if it is negative. */
+    static constexpr int IndexShuffleBits = ShuffleBits;
+
     TBoundedCircularQueueHeap() noexcept
         : TQueueBaseType(),
         CircularBuffer(static_cast<FElementType*>(
@@ -510,7 +1164,7 @@ public:
         for(uint i = 0; i < RoundedSize; ++i)
         {
             CircularBuffer[i]       = TNil;
-            CircularBufferStates[i] = EBufferNodeState::Empty;
+            CircularBufferStates[i] = EBufferNodeState::EMPTY;
         }
     }
 
@@ -531,26 +1185,58 @@ public:
 
     virtual FORCEINLINE void Push(const FElementType& NewElement) noexcept(Q_NOEXCEPT_ENABLED) override
     {
-        const uint ThisIndex = TQueueBaseType::template IncrementProducerCursor<TSPSC>();
-        const uint Index = Utils::RemapCursor<ShuffleBits>(ThisIndex & IndexMask);
-        TQueueBaseType::PushBase(NewElement, CircularBufferStates[Index], CircularBuffer[Index]);
+        PushAtCursor(TQueueBaseType::template IncrementProducerCursor<TSPSC>(), NewElement);
     }
 
     virtual FORCEINLINE FElementType Pop() noexcept(Q_NOEXCEPT_ENABLED) override
     {
-        const uint ThisIndex = TQueueBaseType::template IncrementConsumerCursor<TSPSC>();
-        const uint Index = Utils::RemapCursor<ShuffleBits>(ThisIndex & IndexMask);
-        return TQueueBaseType::PopBase(CircularBufferStates[Index], CircularBuffer[Index]);
+        return PopAtCursor(TQueueBaseType::template IncrementConsumerCursor<TSPSC>());
     }
     
     virtual FORCEINLINE bool TryPush(const FElementType& NewElement) noexcept(Q_NOEXCEPT_ENABLED) override
     {
-        return TQueueBaseTypeCommon::TryPushBase([this, &NewElement](){ Push(NewElement); });
+        return TQueueBaseTypeCommon::template TryPushBase<TSPSC>(
+            [this](const uint ThisIndex){ return SlotStateAtCursor(ThisIndex) == EBufferNodeState::EMPTY; },
+            [this, &NewElement](const uint ThisIndex){ PushAtCursor(ThisIndex, NewElement); });
     }
     
     virtual FORCEINLINE bool TryPop(FElementType& OutElement) noexcept(Q_NOEXCEPT_ENABLED) override
     {
-        return TQueueBaseTypeCommon::TryPopBase([this, &OutElement](){ OutElement = Pop(); });
+        return TQueueBaseTypeCommon::template TryPopBase<TSPSC>(
+            [this](const uint ThisIndex){ return SlotStateAtCursor(ThisIndex) == EBufferNodeState::FULL; },
+            [this, &OutElement](const uint ThisIndex){ OutElement = PopAtCursor(ThisIndex); });
+    }
+
+    /** Names this queue in sojourn trace dumps, Name must outlive the dump. No-op unless TTrace. */
+    void SetTraceName(const char* Name) noexcept
+    {
+        SojournStamps.SetName(Name);
+    }
+private:
+    FORCEINLINE EBufferNodeState SlotStateAtCursor(const uint ThisIndex) const noexcept(Q_NOEXCEPT_ENABLED)
+    {
+        return CircularBufferStates[Utils::RemapCursor<ShuffleBits>(ThisIndex & IndexMask)].load(Utils::ACQUIRE);
+    }
+
+    FORCEINLINE void PushAtCursor(const uint ThisIndex, const FElementType& NewElement) noexcept(Q_NOEXCEPT_ENABLED)
+    {
+        const uint Index = Utils::RemapCursor<ShuffleBits>(ThisIndex & IndexMask);
+        if(TTrace)
+        {
+            SojournStamps.OnPush(ThisIndex);
+        }
+        TQueueBaseType::PushBase(NewElement, CircularBufferStates[Index], CircularBuffer[Index]);
+    }
+
+    FORCEINLINE FElementType PopAtCursor(const uint ThisIndex) noexcept(Q_NOEXCEPT_ENABLED)
+    {
+        const uint Index = Utils::RemapCursor<ShuffleBits>(ThisIndex & IndexMask);
+        const FElementType Element = TQueueBaseType::PopBase(CircularBufferStates[Index], CircularBuffer[Index]);
+        if(TTrace)
+        {
+            SojournStamps.OnPop(ThisIndex);
+        }
+        return Element;
     }
 };
 
@@ -575,6 +1261,9 @@ protected:
     
 public:
     using TElementType = FElementType;
+
+    /** Push and TryPush claim the producer cursor with a seq_cst RMW, which also orders the element before later loads. */
+    static constexpr bool bTotalOrderPush = TTotalOrder && !TSPSC;
     
     TBoundedCircularAtomicQueueBase() noexcept
         : TQueueBaseType()
@@ -634,7 +1323,7 @@ protected:
         {
             for(;;)
             {
-                FElementType Element = QueueIndex.load(Utils::RELAXED);
+                FElementType Element = QueueIndex.load(Utils::ACQUIRE);
                 if(Element != TNil)
                 {
                     QueueIndex.store(TNil, Utils::RELEASE);
@@ -650,7 +1339,7 @@ protected:
         {
             for(;;)
             {
-                FElementType Element = QueueIndex.exchange(TNil, Utils::RELEASE);
+                FElementType Element = QueueIndex.exchange(TNil, Utils::ACQUIRE);
                 if(Element != TNil)
                 {
                     return Element;
@@ -667,8 +1356,8 @@ protected:
     }
 };
 
-template<typename T, uint TQueueSize, T TNil = T{}, bool TTotalOrder = true, bool TMaxThroughput = true, bool TSPSC = false>
-class CACHE_ALIGN TBoundedCircularAtomicQueue : public TBoundedCircularAtomicQueueBase<T, TNil, TQueueSize, TTotalOrder, TMaxThroughput, TSPSC>
+template<typename T, uint TQueueSize, T TNil = T{}, bool TTotalOrder = true, bool TMaxThroughput = true, bool TSPSC = false, bool TTrace = false, int TShuffleBits = -1>
+class CACHE_ALIGN TBoundedCircularAtomicQueue : public TBoundedCircularAtomicQueueBase<T, TQueueSize, TNil, TTotalOrder, TMaxThroughput, TSPSC>
 {
     using TQueueBaseTypeCommon  = TBoundedQueueCommon<T, TQueueSize, TTotalOrder>;
     using TQueueBaseType        = TBoundedCircularAtomicQueueBase<T, TQueueSize, TNil, TTotalOrder, TMaxThroughput, TSPSC>;
@@ -676,13 +1365,19 @@ class CACHE_ALIGN TBoundedCircularAtomicQueue : public TBoundedCircularAtomicQue
 
     static constexpr uint                       TypeSize = TQueueBaseType::TypeSize;
     static constexpr uint                       RoundedSize = TQueueBaseType::RoundedSize;
-    static constexpr int                        ShuffleBits = Utils::GetIndexShuffleBits<RoundedSize,
-                                                    PLATFORM_CACHE_LINE_SIZE / TypeSize>::Value;
+    static constexpr int                        ShuffleBits = TShuffleBits >= 0 ? TShuffleBits
+                                                    : Utils::GetIndexShuffleBits<RoundedSize, PLATFORM_CACHE_LINE_SIZE / TypeSize>::Value;
     static constexpr uint                       IndexMask = TQueueBaseType::IndexMask;
 
+    static_assert(ShuffleBits >= 0 && (1ULL << (ShuffleBits * 2)) <= RoundedSize,  "Shuffle bits need a larger queue!");
+
     CACHE_ALIGN std::atomic<FElementType>       CircularBuffer[RoundedSize];
+    Trace::TSojournStamps<RoundedSize, TTrace>  SojournStamps;
 
 public:
+    /** Bits of the cursor swapped by Utils::RemapCursor, from TShuffleBits or derived from the cache line size if it is negative. */
+    static constexpr int IndexShuffleBits = ShuffleBits;
+
     TBoundedCircularAtomicQueue() noexcept
         : TQueueBaseType()
     {
@@ -702,32 +1397,64 @@ public:
 
     virtual FORCEINLINE void Push(const FElementType& NewElement) noexcept(Q_NOEXCEPT_ENABLED) override
     {
-        const uint ThisIndex = TQueueBaseType::template IncrementProducerCursor<TSPSC>();
-        std::atomic<FElementType>& Element = Utils::MapElement<FElementType, ShuffleBits>(CircularBuffer, ThisIndex & IndexMask);
-        TQueueBaseType::PushBase(NewElement, Element);
+        PushAtCursor(TQueueBaseType::template IncrementProducerCursor<TSPSC>(), NewElement);
     }
     
     virtual FORCEINLINE FElementType Pop() noexcept(Q_NOEXCEPT_ENABLED) override
     {
-        const uint ThisIndex = TQueueBaseType::template IncrementConsumerCursor<TSPSC>();
-        std::atomic<FElementType>& Element = Utils::MapElement<FElementType, ShuffleBits>(CircularBuffer, ThisIndex & IndexMask);
-        return TQueueBaseType::PopBase(Element);
+        return PopAtCursor(TQueueBaseType::template IncrementConsumerCursor<TSPSC>());
     }
     
     virtual FORCEINLINE bool TryPush(const FElementType& NewElement) noexcept(Q_NOEXCEPT_ENABLED) override
     {
-        return TQueueBaseTypeCommon::TryPush([this, &NewElement](){ Push(NewElement); });
+        return TQueueBaseTypeCommon::template TryPushBase<TSPSC>(
+            [this](const uint ThisIndex){ return ElementAtCursor(ThisIndex).load(Utils::ACQUIRE) == TNil; },
+            [this, &NewElement](const uint ThisIndex){ PushAtCursor(ThisIndex, NewElement); });
     }
     
     virtual FORCEINLINE bool TryPop(FElementType& OutElement) noexcept(Q_NOEXCEPT_ENABLED) override
     {
-        return TQueueBaseTypeCommon::TryPop([this, &OutElement](){ OutElement = Pop(); });
+        return TQueueBaseTypeCommon::template TryPopBase<TSPSC>(
+            [this](const uint ThisIndex){ return ElementAtCursor(ThisIndex).load(Utils::ACQUIRE) != TNil; },
+            [this, &OutElement](const uint ThisIndex){ OutElement = PopAtCursor(ThisIndex); });
+    }
+
+    /** Names this queue in sojourn trace dumps, Name must outlive the dump. No-op unless TTrace. */
+    void SetTraceName(const char* Name) noexcept
+    {
+        SojournStamps.SetName(Name);
+    }
+private:
+    FORCEINLINE std::atomic<FElementType>& ElementAtCursor(const uint ThisIndex) noexcept(Q_NOEXCEPT_ENABLED)
+    {
+        return Utils::MapElement<std::atomic<FElementType>, ShuffleBits>(CircularBuffer, ThisIndex & IndexMask);
+    }
+
+    FORCEINLINE void PushAtCursor(const uint ThisIndex, const FElementType& NewElement) noexcept(Q_NOEXCEPT_ENABLED)
+    {
+        std::atomic<FElementType>& Element = ElementAtCursor(ThisIndex);
+        if(TTrace)
+        {
+            SojournStamps.OnPush(ThisIndex);
+        }
+        TQueueBaseType::PushBase(NewElement, Element);
+    }
+
+    FORCEINLINE FElementType PopAtCursor(const uint ThisIndex) noexcept(Q_NOEXCEPT_ENABLED)
+    {
+        std::atomic<FElementType>& Element = ElementAtCursor(ThisIndex);
+        const FElementType PoppedElement = TQueueBaseType::PopBase(Element);
+        if(TTrace)
+        {
+            SojournStamps.OnPop(ThisIndex);
+        }
+        return PoppedElement;
     }
 };
 
 
-template<typename T, uint TQueueSize, T TNil = T{}, bool TTotalOrder = true, bool TMaxThroughput = true, bool TSPSC = false>
-class CACHE_ALIGN TBoundedCircularAtomicQueueHeap : public TBoundedCircularAtomicQueueBase<T, TQueueSize, TTotalOrder, TMaxThroughput, TSPSC>
+template<typename T, uint TQueueSize, T TNil = T{}, bool TTotalOrder = true, bool TMaxThroughput = true, bool TSPSC = false, bool TTrace = false, int TShuffleBits = -1>
+class CACHE_ALIGN TBoundedCircularAtomicQueueHeap : public TBoundedCircularAtomicQueueBase<T, TQueueSize, TNil, TTotalOrder, TMaxThroughput, TSPSC>
 {
     using TQueueBaseTypeCommon  = TBoundedQueueCommon<T, TQueueSize, TTotalOrder>;
     using TQueueBaseType        = TBoundedCircularAtomicQueueBase<T, TQueueSize, TNil, TTotalOrder, TMaxThroughput, TSPSC>;
@@ -735,13 +1462,19 @@ class CACHE_ALIGN TBoundedCircularAtomicQueueHeap : public TBoundedCircularAtomi
 
     static constexpr uint                       TypeSize = TQueueBaseType::TypeSize;
     static constexpr uint                       RoundedSize = TQueueBaseType::RoundedSize;
-    static constexpr int                        ShuffleBits = Utils::GetIndexShuffleBits<RoundedSize,
-                                                    PLATFORM_CACHE_LINE_SIZE / TypeSize>::Value;
+    static constexpr int                        ShuffleBits = TShuffleBits >= 0 ? TShuffleBits
+                                                    : Utils::GetIndexShuffleBits<RoundedSize, PLATFORM_CACHE_LINE_SIZE / TypeSize>::Value;
     static constexpr uint                       IndexMask = TQueueBaseType::IndexMask;
 
+    static_assert(ShuffleBits >= 0 && (1ULL << (ShuffleBits * 2)) <= RoundedSize,  "Shuffle bits need a larger queue!");
+
     CACHE_ALIGN std::atomic<FElementType>       *CircularBuffer;
+    Trace::TSojournStamps<RoundedSize, TTrace>  SojournStamps;
 
 public:
+    /** Bits of the cursor swapped by Utils::RemapCursor, from TShuffleBits or derived from the cache line size if it is negative. */
+    static constexpr int IndexShuffleBits = ShuffleBits;
+
     TBoundedCircularAtomicQueueHeap() noexcept
         : TQueueBaseType(),
         CircularBuffer(static_cast<std::atomic<FElementType>*>(
@@ -766,33 +1499,507 @@ public:
     
     virtual FORCEINLINE void Push(const FElementType& NewElement) noexcept(Q_NOEXCEPT_ENABLED) override
     {
-        const uint ThisIndex = TQueueBaseType::template IncrementProducerCursor<TSPSC>();
-        std::atomic<FElementType>& Element = Utils::MapElement<FElementType, ShuffleBits>(CircularBuffer, ThisIndex & IndexMask);
-        TQueueBaseType::PushBase(NewElement, Element);
+        PushAtCursor(TQueueBaseType::template IncrementProducerCursor<TSPSC>(), NewElement);
     }
     
     virtual FORCEINLINE FElementType Pop() noexcept(Q_NOEXCEPT_ENABLED) override
     {
-        const uint ThisIndex = TQueueBaseType::template IncrementConsumerCursor<TSPSC>();
-        std::atomic<FElementType>& Element = Utils::MapElement<FElementType, ShuffleBits>(CircularBuffer, ThisIndex & IndexMask);
-        return TQueueBaseType::PopBase(Element);
+        return PopAtCursor(TQueueBaseType::template IncrementConsumerCursor<TSPSC>());
     }
     
     virtual FORCEINLINE bool TryPush(const FElementType& NewElement) noexcept(Q_NOEXCEPT_ENABLED) override
     {
-        return TQueueBaseTypeCommon::TryPush([this, &NewElement](){ Push(NewElement); });
+        return TQueueBaseTypeCommon::template TryPushBase<TSPSC>(
+            [this](const uint ThisIndex){ return ElementAtCursor(ThisIndex).load(Utils::ACQUIRE) == TNil; },
+            [this, &NewElement](const uint ThisIndex){ PushAtCursor(ThisIndex, NewElement); });
     }
     
     virtual FORCEINLINE bool TryPop(FElementType& OutElement) noexcept(Q_NOEXCEPT_ENABLED) override
     {
-        return TQueueBaseTypeCommon::TryPop([this, &OutElement](){ OutElement = Pop(); });
+        return TQueueBaseTypeCommon::template TryPopBase<TSPSC>(
+            [this](const uint ThisIndex){ return ElementAtCursor(ThisIndex).load(Utils::ACQUIRE) != TNil; },
+            [this, &OutElement](const uint ThisIndex){ OutElement = PopAtCursor(ThisIndex); });
+    }
+
+    /** Names this queue in sojourn trace dumps, Name must outlive the dump. No-op unless TTrace. */
+    void SetTraceName(const char* Name) noexcept
+    {
+        SojournStamps.SetName(Name);
+    }
+private:
+    FORCEINLINE std::atomic<FElementType>& ElementAtCursor(const uint ThisIndex) noexcept(Q_NOEXCEPT_ENABLED)
+    {
+        return Utils::MapElement<std::atomic<FElementType>, ShuffleBits>(CircularBuffer, ThisIndex & IndexMask);
+    }
+
+    FORCEINLINE void PushAtCursor(const uint ThisIndex, const FElementType& NewElement) noexcept(Q_NOEXCEPT_ENABLED)
+    {
+        std::atomic<FElementType>& Element = ElementAtCursor(ThisIndex);
+        if(TTrace)
+        {
+            SojournStamps.OnPush(ThisIndex);
+        }
+        TQueueBaseType::PushBase(NewElement, Element);
+    }
+
+    FORCEINLINE FElementType PopAtCursor(const uint ThisIndex) noexcept(Q_NOEXCEPT_ENABLED)
+    {
+        std::atomic<FElementType>& Element = ElementAtCursor(ThisIndex);
+        const FElementType PoppedElement = TQueueBaseType::PopBase(Element);
+        if(TTrace)
+        {
+            SojournStamps.OnPop(ThisIndex);
+        }
+        return PoppedElement;
     }
 };
-    
-} // AtomicQueue namespace
 
 //////////////////////// END ATOMIC QUEUE VERSIONS //////////////////////////
 
+////////////////////////////////////////////////////////////////////////////
+///
+///                     FLAT COMBINING QUEUE VERSIONS
+///
+////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Bounded MPMC queue for very high thread counts, built on flat combining instead of shared cursors.
+ *
+ * Each thread publishes its Push or Pop in its own cache-line record. Whichever thread takes the combiner lock
+ * applies every published operation to a plain sequential ring in one pass and hands results back through the
+ * records, so the ring and its cursors stay in the combiner's cache and waiting threads only spin on their own
+ * line. Below a few dozen contending threads the extra hand-off costs more than TBoundedCircularQueue's
+ * fetch_add, run the benchmark with `combining` to find the crossover on the target machine.
+ *
+ * A thread claims one of the queue's TMaxThreads records on its first operation and keeps it until it exits, so
+ * combiners only scan records of threads that use this queue and are still alive. Threads that find every record
+ * claimed take the combiner lock themselves.
+ */
+template<typename T, uint TQueueSize, uint TMaxThreads = 64>
+class CACHE_ALIGN TFlatCombiningQueue : private Utils::FThreadSlotListener
+{
+    static_assert(TQueueSize > 0,                                              "Queue too small!");
+    static_assert(TQueueSize < (1U << ((sizeof(uint) * 8) - 1)) - 1,           "Queue too large!");
+    static_assert(TMaxThreads > 0,                                             "No combining records!");
+    static_assert(TMaxThreads < 0xFFFF,                                        "Too many combining records!");
+
+    using FElementType                          = T;
+
+    static constexpr uint                       RoundedSize = Utils::RoundQueueSizeUpToNearestPowerOfTwo(TQueueSize);
+    static constexpr uint                       IndexMask = RoundedSize - 1;
+    static constexpr uint                       CombinePasses = 3;
+    static constexpr uint16                     NoRecord = 0xFFFF;
+
+    enum class EOperation : uint8
+    {
+        IDLE,
+        PUSH,
+        POP,
+        DONE
+    };
+
+    /* Value and bSucceeded are handed over by the release/acquire on Operation, bClaimed is guarded by the lock. */
+    struct CACHE_ALIGN FRecord
+    {
+        std::atomic<EOperation>                 Operation;
+        bool                                    bClaimed;
+        bool                                    bSucceeded;
+        FElementType                            Value;
+    };
+
+    /* RecordCount is one past the highest claimed record and, like the ring, only touched under the lock. */
+    CACHE_ALIGN std::atomic<bool>               bCombinerLock;
+    uint32                                      RecordCount;
+    uint                                        Head;
+    uint                                        Tail;
+    CACHE_ALIGN FElementType                    Ring[RoundedSize];
+    FRecord                                     Records[TMaxThreads];
+
+    /* Record claimed by the thread holding each Utils::ThreadSlot, only accessed by that thread. */
+    uint16                                      RecordOfSlot[QUEUE_MAX_THREAD_SLOTS];
+
+public:
+    using TElementType = FElementType;
+
+    /** The element lands in the ring under the combiner lock, the caller learns of it through an acquire load. */
+    static constexpr bool bTotalOrderPush = false;
+
+    TFlatCombiningQueue() noexcept(Q_NOEXCEPT_ENABLED)
+        : bCombinerLock{false},
+        RecordCount{0},
+        Head(0),
+        Tail(0),
+        Ring{},
+        Records{}
+    {
+        for(uint16& Record : RecordOfSlot)
+        {
+            Record = NoRecord;
+        }
+        Utils::RegisterThreadSlotListener(this);
+    }
+
+    ~TFlatCombiningQueue() noexcept(Q_NOEXCEPT_ENABLED)
+    {
+        Utils::UnregisterThreadSlotListener(this);
+    }
+
+    TFlatCombiningQueue(const TFlatCombiningQueue&)                 = delete;
+    TFlatCombiningQueue& operator=(const TFlatCombiningQueue&)      = delete;
+
+    FORCEINLINE void Push(const FElementType& NewElement) noexcept(Q_NOEXCEPT_ENABLED)
+    {
+        while(!TryPush(NewElement))
+        {
+            SPIN_LOOP_PAUSE();
+        }
+    }
+
+    FORCEINLINE FElementType Pop() noexcept(Q_NOEXCEPT_ENABLED)
+    {
+        FElementType PoppedElement;
+        while(!TryPop(PoppedElement))
+        {
+            SPIN_LOOP_PAUSE();
+        }
+        return PoppedElement;
+    }
+
+    FORCEINLINE bool TryPush(const FElementType& NewElement) noexcept(Q_NOEXCEPT_ENABLED)
+    {
+        FRecord* Record = AcquireRecord();
+        if(!Record)
+        {
+            LockCombiner();
+            const bool bPushed = ApplyPush(NewElement);
+            CombineAndUnlock();
+            return bPushed;
+        }
+
+        Record->Value = NewElement;
+        return Execute(*Record, EOperation::PUSH);
+    }
+
+    FORCEINLINE bool TryPop(FElementType& OutElement) noexcept(Q_NOEXCEPT_ENABLED)
+    {
+        FRecord* Record = AcquireRecord();
+        if(!Record)
+        {
+            LockCombiner();
+            const bool bPopped = ApplyPop(OutElement);
+            CombineAndUnlock();
+            return bPopped;
+        }
+
+        if(!Execute(*Record, EOperation::POP))
+        {
+            return false;
+        }
+        OutElement = Record->Value;
+        return true;
+    }
+
+private:
+    FORCEINLINE FRecord* AcquireRecord() noexcept(Q_NOEXCEPT_ENABLED)
+    {
+        const uint32 Slot = Utils::ThreadSlot();
+        if(Slot == Utils::InvalidThreadSlot)
+        {
+            return nullptr;
+        }
+
+        if(RecordOfSlot[Slot] == NoRecord)
+        {
+            RecordOfSlot[Slot] = ClaimRecord();
+            if(RecordOfSlot[Slot] == NoRecord)
+            {
+                return nullptr;
+            }
+        }
+        return &Records[RecordOfSlot[Slot]];
+    }
+
+    /** Takes the lowest free record under the lock, so the combiner sees it from its next pass on. */
+    uint16 ClaimRecord() noexcept(Q_NOEXCEPT_ENABLED)
+    {
+        uint16 Claimed = NoRecord;
+        LockCombiner();
+        for(uint16 i = 0; i < TMaxThreads; ++i)
+        {
+            if(!Records[i].bClaimed)
+            {
+                Records[i].bClaimed = true;
+                RecordCount = RecordCount > i ? RecordCount : i + 1;
+                Claimed = i;
+                break;
+            }
+        }
+        CombineAndUnlock();
+        return Claimed;
+    }
+
+    /* Runs on the exiting thread, which has no operation in flight. */
+    void OnThreadSlotReleased(const uint32 Slot) noexcept override
+    {
+        const uint16 Released = RecordOfSlot[Slot];
+        if(Released == NoRecord)
+        {
+            return;
+        }
+        RecordOfSlot[Slot] = NoRecord;
+
+        LockCombiner();
+        Records[Released].bClaimed = false;
+        while(RecordCount > 0 && !Records[RecordCount - 1].bClaimed)
+        {
+            --RecordCount;
+        }
+        bCombinerLock.store(false, Utils::RELEASE);
+    }
+
+    /** Publishes Operation and waits until some combiner, possibly this thread, has applied it. */
+    FORCEINLINE bool Execute(FRecord& Record, const EOperation Operation) noexcept(Q_NOEXCEPT_ENABLED)
+    {
+        Record.Operation.store(Operation, Utils::RELEASE);
+        for(;;)
+        {
+            if(!bCombinerLock.load(Utils::RELAXED) && !bCombinerLock.exchange(true, Utils::ACQUIRE))
+            {
+                CombineAndUnlock();
+            }
+            if(Record.Operation.load(Utils::ACQUIRE) == EOperation::DONE)
+            {
+                break;
+            }
+            SPIN_LOOP_PAUSE();
+        }
+        Record.Operation.store(EOperation::IDLE, Utils::RELAXED);
+        return Record.bSucceeded;
+    }
+
+    FORCEINLINE void LockCombiner() noexcept(Q_NOEXCEPT_ENABLED)
+    {
+        while(bCombinerLock.load(Utils::RELAXED) || bCombinerLock.exchange(true, Utils::ACQUIRE))
+        {
+            SPIN_LOOP_PAUSE();
+        }
+    }
+
+    /** Applies published operations until a pass finds none or CombinePasses ran, then hands the lock back. */
+    FORCEINLINE void CombineAndUnlock() noexcept(Q_NOEXCEPT_ENABLED)
+    {
+        for(uint Pass = 0; Pass < CombinePasses; ++Pass)
+        {
+            bool bAppliedAny = false;
+            for(uint32 i = 0; i < RecordCount; ++i)
+            {
+                FRecord& Record = Records[i];
+                const EOperation Operation = Record.Operation.load(Utils::ACQUIRE);
+                if(Operation == EOperation::PUSH)
+                {
+                    Record.bSucceeded = ApplyPush(Record.Value);
+                }
+                else if(Operation == EOperation::POP)
+                {
+                    Record.bSucceeded = ApplyPop(Record.Value);
+                }
+                else
+                {
+                    continue;
+                }
+                Record.Operation.store(EOperation::DONE, Utils::RELEASE);
+                bAppliedAny = true;
+            }
+            if(!bAppliedAny)
+            {
+                break;
+            }
+        }
+        bCombinerLock.store(false, Utils::RELEASE);
+    }
+
+    FORCEINLINE bool ApplyPush(const FElementType& NewElement) noexcept(Q_NOEXCEPT_ENABLED)
+    {
+        if(Tail - Head == RoundedSize)
+        {
+            return false;
+        }
+        Ring[Tail++ & IndexMask] = NewElement;
+        return true;
+    }
+
+    FORCEINLINE bool ApplyPop(FElementType& OutElement) noexcept(Q_NOEXCEPT_ENABLED)
+    {
+        if(Tail == Head)
+        {
+            return false;
+        }
+        OutElement = Ring[Head++ & IndexMask];
+        return true;
+    }
+};
+
+//////////////////////// END FLAT COMBINING QUEUE VERSIONS //////////////////
+
+////////////////////////////////////////////////////////////////////////////
+///
+///                     CONFLATING QUEUE VERSIONS
+///
+////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Keeps only the latest value per key, for state replication where superseded updates are worthless.
+ *
+ * Push for a key that is already pending overwrites the pending value in place instead of taking a new slot, so
+ * the queue never holds more than TKeyCount entries and the consumer applies one value per dirty key. Each key
+ * has its own cache line with a sequence lock whose only writer is the key's producer, so Push never waits, and
+ * TryPop skips a key caught mid-write rather than waiting: the write in progress queues the key again.
+ *
+ * One producer per key, any number of producers overall, each owning a disjoint set of keys. Single consumer.
+ */
+template<typename T, uint TKeyCount>
+class CACHE_ALIGN TConflatingQueue
+{
+    static_assert(TKeyCount > 0,                                               "Queue too small!");
+    static_assert(std::is_trivially_copyable<T>::value,                        "Values are copied under a sequence lock!");
+
+    using FElementType                          = T;
+
+    static constexpr uint                       InvalidKey = ~0U;
+    static constexpr uint                       ValueWords = (sizeof(FElementType) + sizeof(uint64) - 1) / sizeof(uint64);
+
+    /* The value is copied as relaxed atomic words, so a read racing a write is retried rather than undefined. */
+    struct CACHE_ALIGN FKeySlot
+    {
+        std::atomic<uint32>                     Sequence;
+        std::atomic<uint8>                      bPending;
+        std::atomic<uint64>                     Value[ValueWords];
+    };
+
+    using FDirtyKeyQueue                        = TBoundedCircularAtomicQueue<uint, TKeyCount, InvalidKey>;
+
+    FKeySlot                                    *KeySlots;
+    uint32                                      *DeliveredSequences;
+    FDirtyKeyQueue                              DirtyKeys;
+
+public:
+    TConflatingQueue() noexcept(Q_NOEXCEPT_ENABLED)
+        : KeySlots(new FKeySlot[TKeyCount]()),
+        DeliveredSequences(new uint32[TKeyCount]())
+    {
+    }
+
+    ~TConflatingQueue() noexcept(Q_NOEXCEPT_ENABLED)
+    {
+        delete[] KeySlots;
+        delete[] DeliveredSequences;
+    }
+
+    TConflatingQueue(const TConflatingQueue&)                   = delete;
+    TConflatingQueue& operator=(const TConflatingQueue&)        = delete;
+
+    FORCEINLINE uint KeyCount() const noexcept(Q_NOEXCEPT_ENABLED)
+    {
+        return TKeyCount;
+    }
+
+    /** Publishes NewElement as the latest value for Key, the key is queued only if it wasn't pending yet. */
+    FORCEINLINE void Push(const uint Key, const FElementType& NewElement) noexcept(Q_NOEXCEPT_ENABLED)
+    {
+        assert(Key < TKeyCount);
+        FKeySlot& Slot = KeySlots[Key];
+
+        // Only this thread writes the key, so marking it odd is a plain store. The fence orders it before the value.
+        const uint32 Sequence = Slot.Sequence.load(Utils::RELAXED);
+        Slot.Sequence.store(Sequence + 1, Utils::RELAXED);
+        std::atomic_thread_fence(Utils::RELEASE);
+
+        uint64 Words[ValueWords] = {};
+        memcpy(Words, &NewElement, sizeof(FElementType));
+        for(uint i = 0; i < ValueWords; ++i)
+        {
+            Slot.Value[i].store(Words[i], Utils::RELAXED);
+        }
+        Slot.Sequence.store(Sequence + 2, Utils::RELEASE);
+
+        // At most one queue entry per key, so DirtyKeys can never fill up and Push never waits for room.
+        if(Slot.bPending.exchange(1, Utils::SEQ_CONST) == 0)
+        {
+            DirtyKeys.Push(Key);
+        }
+    }
+
+    /** Pops the next dirty key and its latest value, returns false if no key is pending. */
+    FORCEINLINE bool TryPop(uint& OutKey, FElementType& OutElement) noexcept(Q_NOEXCEPT_ENABLED)
+    {
+        uint Key = InvalidKey;
+        while(DirtyKeys.TryPop(Key))
+        {
+            FKeySlot& Slot = KeySlots[Key];
+
+            // Clear the flag before reading, a Push that lands after this queues the key again.
+            Slot.bPending.exchange(0, Utils::SEQ_CONST);
+
+            const uint32 Sequence = Slot.Sequence.load(Utils::ACQUIRE);
+            if(Sequence & 1)
+            {
+                // That Push sets the flag after we cleared it, so it queues the key again once its value is in.
+                continue;
+            }
+            uint64 Words[ValueWords];
+            for(uint i = 0; i < ValueWords; ++i)
+            {
+                Words[i] = Slot.Value[i].load(Utils::RELAXED);
+            }
+            std::atomic_thread_fence(Utils::ACQUIRE);
+            if(Slot.Sequence.load(Utils::RELAXED) != Sequence)
+            {
+                // Torn by a Push that started after our flag clear, which likewise queues the key again.
+                continue;
+            }
+
+            // A Push between clearing the flag and reading the value re-queues a key whose value we already have.
+            if(DeliveredSequences[Key] == Sequence)
+            {
+                continue;
+            }
+            DeliveredSequences[Key] = Sequence;
+            memcpy(&OutElement, Words, sizeof(FElementType));
+            OutKey = Key;
+            return true;
+        }
+        return false;
+    }
+
+    /** Calls Visitor(Key, Value) once for every key pending at the time of the call, returns how many it visited. */
+    template<typename TVisitor>
+    FORCEINLINE uint Drain(const TVisitor& Visitor) noexcept(Q_NOEXCEPT_ENABLED)
+    {
+        uint Visited = 0;
+        uint Key;
+        FElementType Element;
+        while(Visited < TKeyCount && TryPop(Key, Element))
+        {
+            Visitor(Key, Element);
+            ++Visited;
+        }
+        return Visited;
+    }
+
+    FORCEINLINE bool WasPending(const uint Key) const noexcept(Q_NOEXCEPT_ENABLED)
+    {
+        return KeySlots[Key].bPending.load(Utils::RELAXED) != 0;
+    }
+
+    FORCEINLINE bool WasEmpty() const noexcept(Q_NOEXCEPT_ENABLED)
+    {
+        return DirtyKeys.WasEmpty();
+    }
+};
+
+//////////////////////// END CONFLATING QUEUE VERSIONS //////////////////////
+
+} // AtomicQueue namespace
 
 #undef CACHE_ALIGN
 #undef QUEUE_PADDING_BYTES
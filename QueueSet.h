@@ -0,0 +1,224 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+
+#if defined(_WIN32)
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+    #pragma comment(lib, "Synchronization.lib")
+#elif defined(__linux__)
+    #include <linux/futex.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+
+#include "Queue.h"
+
+#define CACHE_ALIGN alignas(PLATFORM_CACHE_LINE_SIZE)
+#define Q_NOEXCEPT_ENABLED true
+
+namespace AtomicQueue
+{
+    namespace Futex
+    {
+        /** Sleeps while Word still holds Expected. May return spuriously, callers re-check their condition. */
+        FORCEINLINE void Wait(std::atomic<uint32>& Word, const uint32 Expected) noexcept
+        {
+#if defined(_WIN32)
+            uint32 Compare = Expected;
+            WaitOnAddress(&Word, &Compare, sizeof(uint32), INFINITE);
+#elif defined(__linux__)
+            syscall(SYS_futex, reinterpret_cast<uint32*>(&Word), FUTEX_WAIT_PRIVATE, Expected, nullptr, nullptr, 0);
+#else
+            while(Word.load(Utils::ACQUIRE) == Expected)
+            {
+                std::this_thread::yield();
+            }
+#endif
+        }
+
+        FORCEINLINE void WakeOne(std::atomic<uint32>& Word) noexcept
+        {
+#if defined(_WIN32)
+            WakeByAddressSingle(&Word);
+#elif defined(__linux__)
+            syscall(SYS_futex, reinterpret_cast<uint32*>(&Word), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#else
+            (void)Word;
+#endif
+        }
+    } // namespace Futex
+
+    /**
+     * @brief Lets one consumer block on up to 64 queues at once.
+     *
+     * Every registered queue owns one bit of a shared readiness mask. Producers set their queue's bit when they
+     * find it clear, which after the first push only happens again once the consumer has collected the mask, so a
+     * producer pushing into an already ready queue pays a single load. The consumer collects and clears the whole
+     * mask in Wait, sleeping on a futex while it is empty.
+     *
+     * A queue returned by Wait must be drained until TryPop fails, or handed back with MarkReady: its bit stays
+     * clear until the next push finds it clear, and pushes that landed before the collect never set it again.
+     * Single consumer.
+     */
+    class CACHE_ALIGN FQueueSet
+    {
+    public:
+        static constexpr uint32 MaxQueues = 64;
+
+        FQueueSet() noexcept(Q_NOEXCEPT_ENABLED)
+            : ReadyMask{0},
+            QueueCount{0},
+            WakeSequence{0},
+            bConsumerWaiting{false}
+        {
+        }
+
+        FQueueSet(const FQueueSet&)             = delete;
+        FQueueSet& operator=(const FQueueSet&)  = delete;
+
+        /** Hands out the next readiness bit. */
+        uint32 Register() noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            const uint32 Index = QueueCount.fetch_add(1, Utils::RELAXED);
+            assert(Index < MaxQueues);
+            return Index;
+        }
+
+        /**
+         * Producer side, call after publishing an element. The element must be ordered before the mask load by a
+         * seq_cst operation, which TQueueSetMember takes care of.
+         */
+        FORCEINLINE void NotifyReady(const uint32 Index) noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            if((ReadyMask.load(Utils::SEQ_CONST) & (1ULL << Index)) == 0)
+            {
+                MarkReady(Index);
+            }
+        }
+
+        /** Sets Index ready unconditionally and wakes the consumer if it may be asleep. */
+        FORCEINLINE void MarkReady(const uint32 Index) noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            // Only the push that makes the mask non-empty has to wake anyone, later ones find the consumer awake.
+            if(ReadyMask.fetch_or(1ULL << Index, Utils::SEQ_CONST) == 0)
+            {
+                WakeSequence.fetch_add(1, Utils::RELEASE);
+                if(bConsumerWaiting.load(Utils::SEQ_CONST))
+                {
+                    Futex::WakeOne(WakeSequence);
+                }
+            }
+        }
+
+        /** Collects and clears the ready mask without blocking, zero if no queue became ready. */
+        FORCEINLINE uint64 Poll() noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            if(ReadyMask.load(Utils::RELAXED) == 0)
+            {
+                return 0;
+            }
+            const uint64 Ready = ReadyMask.exchange(0, Utils::SEQ_CONST);
+
+            // Pairs with the producers' seq_cst push: either our drain sees their element or they see the clear bit.
+            std::atomic_thread_fence(Utils::SEQ_CONST);
+            return Ready;
+        }
+
+        /** Blocks until at least one queue is ready, then collects and clears the ready mask. */
+        uint64 Wait() noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            for(;;)
+            {
+                const uint64 Ready = Poll();
+                if(Ready)
+                {
+                    return Ready;
+                }
+
+                const uint32 Sequence = WakeSequence.load(Utils::ACQUIRE);
+                bConsumerWaiting.store(true, Utils::SEQ_CONST);
+                if(ReadyMask.load(Utils::SEQ_CONST) == 0)
+                {
+                    Futex::Wait(WakeSequence, Sequence);
+                }
+                bConsumerWaiting.store(false, Utils::RELAXED);
+            }
+        }
+
+    private:
+        std::atomic<uint64>                 ReadyMask;
+        std::atomic<uint32>                 QueueCount;
+        CACHE_ALIGN std::atomic<uint32>     WakeSequence;
+        std::atomic<bool>                   bConsumerWaiting;
+    };
+
+    /**
+     * @brief Producer/consumer view of a queue registered with an FQueueSet.
+     */
+    template<typename TQueue>
+    class TQueueSetMember
+    {
+        using FElementType = typename TQueue::TElementType;
+
+    public:
+        TQueueSetMember(TQueue& InQueue, FQueueSet& InSet) noexcept(Q_NOEXCEPT_ENABLED)
+            : Queue(InQueue),
+            Set(InSet),
+            Index(InSet.Register())
+        {
+        }
+
+        FORCEINLINE uint32 GetIndex() const noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            return Index;
+        }
+
+        FORCEINLINE TQueue& GetQueue() noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            return Queue;
+        }
+
+        FORCEINLINE void Push(const FElementType& NewElement) noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            Queue.Push(NewElement);
+            NotifySet();
+        }
+
+        FORCEINLINE bool TryPush(const FElementType& NewElement) noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            if(!Queue.TryPush(NewElement))
+            {
+                return false;
+            }
+            NotifySet();
+            return true;
+        }
+
+        FORCEINLINE bool TryPop(FElementType& OutElement) noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            return Queue.TryPop(OutElement);
+        }
+
+    private:
+        FORCEINLINE void NotifySet() noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            // Queues without a seq_cst cursor RMW need the fence to order the element before the mask load.
+            if(!TQueue::bTotalOrderPush)
+            {
+                std::atomic_thread_fence(Utils::SEQ_CONST);
+            }
+            Set.NotifyReady(Index);
+        }
+
+        TQueue&         Queue;
+        FQueueSet&      Set;
+        const uint32    Index;
+    };
+} // AtomicQueue namespace
+
+#undef CACHE_ALIGN
+#undef Q_NOEXCEPT_ENABLED
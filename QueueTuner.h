@@ -0,0 +1,289 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "Queue.h"
+
+namespace AtomicQueue
+{
+    namespace Tuning
+    {
+        /** Element of a given size for describing workloads that only care about the bytes moved. */
+        template<uint TBytes>
+        struct TPayload
+        {
+            uint8 Bytes[TBytes];
+        };
+
+        /**
+         * A workload to tune for. Every producer pushes ElementsPerProducer elements in bursts of BurstLength,
+         * sleeping BurstPauseMicroseconds between bursts, while the consumers pop them all.
+         */
+        struct FWorkload
+        {
+            const char*     AliasName;
+            uint32          Producers;
+            uint32          Consumers;
+            uint32          ElementsPerProducer;
+            uint32          BurstLength;
+            uint32          BurstPauseMicroseconds;
+            uint32          Repetitions;
+        };
+
+        struct FConfig
+        {
+            bool            bTotalOrder;
+            bool            bMaxThroughput;
+            bool            bSPSC;
+            int             ShuffleBits;
+            uint            Capacity;
+        };
+
+        struct FResult
+        {
+            FWorkload       Workload;
+            uint            ElementSize;
+            FConfig         Best;
+            double          BestOpsPerSecond;
+            double          DefaultOpsPerSecond;    // Default template arguments at Best.Capacity.
+        };
+
+        /**
+         * Pushes and pops Workload once through a fresh TQueue, returns elements moved per second. Works with any
+         * queue that has TElementType and blocking Push/Pop.
+         */
+        template<typename TQueue>
+        double MeasureOpsPerSecond(const FWorkload& Workload)
+        {
+            using FElementType = typename TQueue::TElementType;
+
+            std::unique_ptr<TQueue> Queue(new TQueue());
+            const uint32 ThreadCount = Workload.Producers + Workload.Consumers;
+            const uint64 TotalElements = static_cast<uint64>(Workload.Producers) * Workload.ElementsPerProducer;
+            const uint32 BurstLength = std::max<uint32>(Workload.BurstLength, 1);
+
+            std::atomic<uint32> ThreadsReady{0};
+            std::atomic<bool> bStart{false};
+            std::vector<std::thread> Threads;
+            for(uint32 i = 0; i < Workload.Producers; ++i)
+            {
+                Threads.emplace_back([&]()
+                {
+                    ThreadsReady.fetch_add(1);
+                    while(!bStart.load(Utils::ACQUIRE))
+                    {
+                        std::this_thread::yield();
+                    }
+
+                    const FElementType Element = {};
+                    for(uint32 j = 0; j < Workload.ElementsPerProducer; ++j)
+                    {
+                        Queue->Push(Element);
+                        if(Workload.BurstPauseMicroseconds && j % BurstLength == BurstLength - 1)
+                        {
+                            std::this_thread::sleep_for(std::chrono::microseconds(Workload.BurstPauseMicroseconds));
+                        }
+                    }
+                });
+            }
+            for(uint32 i = 0; i < Workload.Consumers; ++i)
+            {
+                const uint64 Share = TotalElements / Workload.Consumers + (i == 0 ? TotalElements % Workload.Consumers : 0);
+                Threads.emplace_back([&, Share]()
+                {
+                    ThreadsReady.fetch_add(1);
+                    while(!bStart.load(Utils::ACQUIRE))
+                    {
+                        std::this_thread::yield();
+                    }
+
+                    for(uint64 j = 0; j < Share; ++j)
+                    {
+                        const FElementType Element = Queue->Pop();
+                        (void)Element;
+                    }
+                });
+            }
+
+            while(ThreadsReady.load() < ThreadCount)
+            {
+                std::this_thread::yield();
+            }
+            const auto Start = std::chrono::steady_clock::now();
+            bStart.store(true, Utils::RELEASE);
+            for(std::thread& Thread : Threads)
+            {
+                Thread.join();
+            }
+            const double Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+            return TotalElements / Seconds;
+        }
+
+        /**
+         * @brief Runs a workload against every TBoundedCircularQueue<T> configuration in the grid of TTotalOrder,
+         * TMaxThroughput, TSPSC (single producer and consumer workloads only), ShuffleBits (none or derived from
+         * the cache line) and each of TCapacities, and picks the fastest.
+         *
+         * Every configuration is a separate instantiation, so keep the capacity list short.
+         */
+        template<typename T, uint... TCapacities>
+        class TQueueTuner
+        {
+            static_assert(sizeof...(TCapacities) > 0,                          "No capacities to tune!");
+
+        public:
+            /** Measures every configuration, printing one line per configuration to Log if it isn't null. */
+            static FResult Run(const FWorkload& Workload, FILE* Log = stdout)
+            {
+                FResult Result = {};
+                Result.Workload = Workload;
+                Result.ElementSize = sizeof(T);
+
+                FSearch Search{Workload, Log, Result, {}, 0};
+                const int Unused[] = {(RunCapacity<TCapacities>(Search), 0)...};
+                (void)Unused;
+
+                for(uint i = 0; i < CapacityCount; ++i)
+                {
+                    if(Search.DefaultResults[i].Capacity == Result.Best.Capacity)
+                    {
+                        Result.DefaultOpsPerSecond = Search.DefaultResults[i].OpsPerSecond;
+                        break;
+                    }
+                }
+                return Result;
+            }
+
+        private:
+            static constexpr uint CapacityCount = sizeof...(TCapacities);
+
+            struct FDefaultResult
+            {
+                uint            Capacity;
+                double          OpsPerSecond;
+            };
+
+            struct FSearch
+            {
+                const FWorkload&    Workload;
+                FILE*               Log;
+                FResult&            Result;
+                FDefaultResult      DefaultResults[CapacityCount];
+                uint                DefaultCount;
+            };
+
+            /** What TBoundedCircularQueue picks for this capacity when TShuffleBits is left at -1. */
+            template<uint TCapacity>
+            static constexpr int DerivedShuffleBits()
+            {
+                return TBoundedCircularQueue<T, TCapacity>::IndexShuffleBits;
+            }
+
+            template<uint TCapacity>
+            static void RunCapacity(FSearch& Search)
+            {
+                RunShuffleBits<TCapacity, false, false>(Search);
+                RunShuffleBits<TCapacity, false, true>(Search);
+                RunShuffleBits<TCapacity, true, false>(Search);
+                RunShuffleBits<TCapacity, true, true>(Search);
+            }
+
+            template<uint TCapacity, bool TTotalOrder, bool TMaxThroughput>
+            static void RunShuffleBits(FSearch& Search)
+            {
+                RunSPSC<TCapacity, TTotalOrder, TMaxThroughput, 0>(Search);
+                if(DerivedShuffleBits<TCapacity>() != 0)
+                {
+                    RunSPSC<TCapacity, TTotalOrder, TMaxThroughput, DerivedShuffleBits<TCapacity>()>(Search);
+                }
+            }
+
+            template<uint TCapacity, bool TTotalOrder, bool TMaxThroughput, int TShuffleBits>
+            static void RunSPSC(FSearch& Search)
+            {
+                Measure<TCapacity, TTotalOrder, TMaxThroughput, false, TShuffleBits>(Search);
+                if(Search.Workload.Producers == 1 && Search.Workload.Consumers == 1)
+                {
+                    Measure<TCapacity, TTotalOrder, TMaxThroughput, true, TShuffleBits>(Search);
+                }
+            }
+
+            template<uint TCapacity, bool TTotalOrder, bool TMaxThroughput, bool TSPSC, int TShuffleBits>
+            static void Measure(FSearch& Search)
+            {
+                using FQueue = TBoundedCircularQueue<T, TCapacity, TTotalOrder, TMaxThroughput, TSPSC, false, TShuffleBits>;
+
+                const FWorkload& Workload = Search.Workload;
+                std::vector<double> Samples;
+                for(uint32 i = 0; i < std::max<uint32>(Workload.Repetitions, 1); ++i)
+                {
+                    Samples.push_back(MeasureOpsPerSecond<FQueue>(Workload));
+                }
+                std::sort(Samples.begin(), Samples.end());
+                const double Median = Samples[Samples.size() / 2];
+
+                const FConfig Config = {TTotalOrder, TMaxThroughput, TSPSC, TShuffleBits, TCapacity};
+                if(Search.Log)
+                {
+                    fprintf(Search.Log, "%-24s cap %6u total order %d max throughput %d spsc %d shuffle %d: %7.2f M ops/s\n",
+                        Workload.AliasName, TCapacity, TTotalOrder, TMaxThroughput, TSPSC, TShuffleBits, Median / 1e6);
+                }
+
+                FResult& Result = Search.Result;
+                if(Median > Result.BestOpsPerSecond)
+                {
+                    Result.Best = Config;
+                    Result.BestOpsPerSecond = Median;
+                }
+
+                // Default template arguments per capacity, Run reports the one at the winning capacity.
+                if(TTotalOrder && TMaxThroughput && !TSPSC && TShuffleBits == DerivedShuffleBits<TCapacity>())
+                {
+                    Search.DefaultResults[Search.DefaultCount++] = FDefaultResult{TCapacity, Median};
+                }
+            }
+        };
+
+        /**
+         * Writes a header with one TBoundedCircularQueue alias per result, named after its workload's AliasName
+         * and taking the element type as its only parameter. Returns false if Path can't be written.
+         */
+        inline bool WriteRecommendationsHeader(const char* Path, const FResult* Results, const uint Count)
+        {
+            FILE* File = fopen(Path, "w");
+            if(!File)
+            {
+                return false;
+            }
+
+            fprintf(File, "#pragma once\n\n");
+            fprintf(File, "// Generated by AtomicQueue::Tuning::TQueueTuner, rerun the tuner instead of editing by hand.\n\n");
+            fprintf(File, "#include \"Queue.h\"\n\n");
+            fprintf(File, "static_assert(PLATFORM_CACHE_LINE_SIZE == %d, \"Tuned for %d-byte cache lines!\");\n",
+                PLATFORM_CACHE_LINE_SIZE, PLATFORM_CACHE_LINE_SIZE);
+
+            for(uint i = 0; i < Count; ++i)
+            {
+                const FResult& Result = Results[i];
+                const FWorkload& Workload = Result.Workload;
+                const FConfig& Best = Result.Best;
+                fprintf(File, "\n// %u producers, %u consumers, %u-byte elements, bursts of %u with %u us pauses.\n",
+                    Workload.Producers, Workload.Consumers, Result.ElementSize, Workload.BurstLength, Workload.BurstPauseMicroseconds);
+                fprintf(File, "// %.2f M ops/s, default arguments at the same capacity reached %.2f M ops/s.\n",
+                    Result.BestOpsPerSecond / 1e6, Result.DefaultOpsPerSecond / 1e6);
+                fprintf(File, "template<typename T>\nusing %s = AtomicQueue::TBoundedCircularQueue<T, %u, %s, %s, %s, false, %d>;\n",
+                    Workload.AliasName, Best.Capacity, Best.bTotalOrder ? "true" : "false",
+                    Best.bMaxThroughput ? "true" : "false", Best.bSPSC ? "true" : "false", Best.ShuffleBits);
+            }
+
+            fclose(File);
+            return true;
+        }
+    } // namespace Tuning
+} // AtomicQueue namespace
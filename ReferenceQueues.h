@@ -0,0 +1,283 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+#include "Queue.h"
+
+#define CACHE_ALIGN alignas(PLATFORM_CACHE_LINE_SIZE)
+#define Q_NOEXCEPT_ENABLED true
+
+namespace AtomicQueue
+{
+    /**
+     * Textbook queue designs kept as fixed baselines for the `reference` benchmark, deliberately plain so Queue.h
+     * types are judged against known designs rather than against each other. Not meant for production use.
+     *
+     * Unreal's own TAtomicQueue is not among them: engine source is under the Unreal Engine EULA and can't be
+     * redistributed in this GPLv3 repository. Compare against it inside an engine checkout instead.
+     */
+    namespace Reference
+    {
+        /**
+         * @brief std::deque behind a mutex, producers and consumers block on condition variables.
+         */
+        template<typename T, uint TQueueSize>
+        class TMutexDequeQueue
+        {
+            using FElementType = T;
+
+        public:
+            using TElementType = FElementType;
+
+            TMutexDequeQueue() = default;
+
+            TMutexDequeQueue(const TMutexDequeQueue&)               = delete;
+            TMutexDequeQueue& operator=(const TMutexDequeQueue&)    = delete;
+
+            void Push(const FElementType& NewElement)
+            {
+                std::unique_lock<std::mutex> Lock(Mutex);
+                NotFull.wait(Lock, [this]() { return Elements.size() < TQueueSize; });
+                Elements.push_back(NewElement);
+                Lock.unlock();
+                NotEmpty.notify_one();
+            }
+
+            FElementType Pop()
+            {
+                std::unique_lock<std::mutex> Lock(Mutex);
+                NotEmpty.wait(Lock, [this]() { return !Elements.empty(); });
+                const FElementType Element = Elements.front();
+                Elements.pop_front();
+                Lock.unlock();
+                NotFull.notify_one();
+                return Element;
+            }
+
+            bool TryPush(const FElementType& NewElement)
+            {
+                {
+                    std::lock_guard<std::mutex> Lock(Mutex);
+                    if(Elements.size() >= TQueueSize)
+                    {
+                        return false;
+                    }
+                    Elements.push_back(NewElement);
+                }
+                NotEmpty.notify_one();
+                return true;
+            }
+
+            bool TryPop(FElementType& OutElement)
+            {
+                {
+                    std::lock_guard<std::mutex> Lock(Mutex);
+                    if(Elements.empty())
+                    {
+                        return false;
+                    }
+                    OutElement = Elements.front();
+                    Elements.pop_front();
+                }
+                NotFull.notify_one();
+                return true;
+            }
+
+        private:
+            std::mutex                  Mutex;
+            std::condition_variable     NotFull;
+            std::condition_variable     NotEmpty;
+            std::deque<FElementType>    Elements;
+        };
+
+        /**
+         * @brief Dmitry Vyukov's bounded MPMC queue: per-cell sequence numbers, cursors claimed by CAS.
+         *
+         * @cite https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+         */
+        template<typename T, uint TQueueSize>
+        class TVyukovQueue
+        {
+            using FElementType = T;
+
+            static constexpr uint   RoundedSize = Utils::RoundQueueSizeUpToNearestPowerOfTwo(TQueueSize);
+            static constexpr uint   IndexMask = RoundedSize - 1;
+
+            struct FCell
+            {
+                std::atomic<uint>   Sequence;
+                FElementType        Element;
+            };
+
+        public:
+            using TElementType = FElementType;
+
+            TVyukovQueue() noexcept(Q_NOEXCEPT_ENABLED)
+                : EnqueueCursor{0},
+                DequeueCursor{0}
+            {
+                for(uint i = 0; i < RoundedSize; ++i)
+                {
+                    Cells[i].Sequence.store(i, Utils::RELAXED);
+                }
+            }
+
+            TVyukovQueue(const TVyukovQueue&)               = delete;
+            TVyukovQueue& operator=(const TVyukovQueue&)    = delete;
+
+            FORCEINLINE void Push(const FElementType& NewElement) noexcept(Q_NOEXCEPT_ENABLED)
+            {
+                while(!TryPush(NewElement))
+                {
+                    Utils::SpinLoopPause();
+                }
+            }
+
+            FORCEINLINE FElementType Pop() noexcept(Q_NOEXCEPT_ENABLED)
+            {
+                FElementType PoppedElement;
+                while(!TryPop(PoppedElement))
+                {
+                    Utils::SpinLoopPause();
+                }
+                return PoppedElement;
+            }
+
+            FORCEINLINE bool TryPush(const FElementType& NewElement) noexcept(Q_NOEXCEPT_ENABLED)
+            {
+                uint Cursor = EnqueueCursor.load(Utils::RELAXED);
+                for(;;)
+                {
+                    FCell& Cell = Cells[Cursor & IndexMask];
+                    const int Difference = static_cast<int>(Cell.Sequence.load(Utils::ACQUIRE) - Cursor);
+                    if(Difference == 0)
+                    {
+                        if(EnqueueCursor.compare_exchange_weak(Cursor, Cursor + 1, Utils::RELAXED))
+                        {
+                            Cell.Element = NewElement;
+                            Cell.Sequence.store(Cursor + 1, Utils::RELEASE);
+                            return true;
+                        }
+                    }
+                    else if(Difference < 0)
+                    {
+                        return false;
+                    }
+                    else
+                    {
+                        Cursor = EnqueueCursor.load(Utils::RELAXED);
+                    }
+                }
+            }
+
+            FORCEINLINE bool TryPop(FElementType& OutElement) noexcept(Q_NOEXCEPT_ENABLED)
+            {
+                uint Cursor = DequeueCursor.load(Utils::RELAXED);
+                for(;;)
+                {
+                    FCell& Cell = Cells[Cursor & IndexMask];
+                    const int Difference = static_cast<int>(Cell.Sequence.load(Utils::ACQUIRE) - (Cursor + 1));
+                    if(Difference == 0)
+                    {
+                        if(DequeueCursor.compare_exchange_weak(Cursor, Cursor + 1, Utils::RELAXED))
+                        {
+                            OutElement = Cell.Element;
+                            Cell.Sequence.store(Cursor + RoundedSize, Utils::RELEASE);
+                            return true;
+                        }
+                    }
+                    else if(Difference < 0)
+                    {
+                        return false;
+                    }
+                    else
+                    {
+                        Cursor = DequeueCursor.load(Utils::RELAXED);
+                    }
+                }
+            }
+
+        private:
+            CACHE_ALIGN std::atomic<uint>   EnqueueCursor;
+            CACHE_ALIGN std::atomic<uint>   DequeueCursor;
+            CACHE_ALIGN FCell               Cells[RoundedSize];
+        };
+
+        /**
+         * @brief Single producer, single consumer ring with one release/acquire cursor per side.
+         */
+        template<typename T, uint TQueueSize>
+        class TSPSCRingQueue
+        {
+            using FElementType = T;
+
+            static constexpr uint   RoundedSize = Utils::RoundQueueSizeUpToNearestPowerOfTwo(TQueueSize);
+            static constexpr uint   IndexMask = RoundedSize - 1;
+
+        public:
+            using TElementType = FElementType;
+
+            TSPSCRingQueue() noexcept(Q_NOEXCEPT_ENABLED)
+                : Head{0},
+                Tail{0}
+            {
+            }
+
+            TSPSCRingQueue(const TSPSCRingQueue&)               = delete;
+            TSPSCRingQueue& operator=(const TSPSCRingQueue&)    = delete;
+
+            FORCEINLINE void Push(const FElementType& NewElement) noexcept(Q_NOEXCEPT_ENABLED)
+            {
+                while(!TryPush(NewElement))
+                {
+                    Utils::SpinLoopPause();
+                }
+            }
+
+            FORCEINLINE FElementType Pop() noexcept(Q_NOEXCEPT_ENABLED)
+            {
+                FElementType PoppedElement;
+                while(!TryPop(PoppedElement))
+                {
+                    Utils::SpinLoopPause();
+                }
+                return PoppedElement;
+            }
+
+            FORCEINLINE bool TryPush(const FElementType& NewElement) noexcept(Q_NOEXCEPT_ENABLED)
+            {
+                const uint CurrentTail = Tail.load(Utils::RELAXED);
+                if(CurrentTail - Head.load(Utils::ACQUIRE) == RoundedSize)
+                {
+                    return false;
+                }
+                Ring[CurrentTail & IndexMask] = NewElement;
+                Tail.store(CurrentTail + 1, Utils::RELEASE);
+                return true;
+            }
+
+            FORCEINLINE bool TryPop(FElementType& OutElement) noexcept(Q_NOEXCEPT_ENABLED)
+            {
+                const uint CurrentHead = Head.load(Utils::RELAXED);
+                if(CurrentHead == Tail.load(Utils::ACQUIRE))
+                {
+                    return false;
+                }
+                OutElement = Ring[CurrentHead & IndexMask];
+                Head.store(CurrentHead + 1, Utils::RELEASE);
+                return true;
+            }
+
+        private:
+            CACHE_ALIGN std::atomic<uint>   Head;
+            CACHE_ALIGN std::atomic<uint>   Tail;
+            CACHE_ALIGN FElementType        Ring[RoundedSize];
+        };
+    } // namespace Reference
+} // AtomicQueue namespace
+
+#undef CACHE_ALIGN
+#undef Q_NOEXCEPT_ENABLED
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+#include "Queue.h"
+
+#define CACHE_ALIGN alignas(PLATFORM_CACHE_LINE_SIZE)
+#define Q_NOEXCEPT_ENABLED true
+
+namespace AtomicQueue
+{
+    /**
+     * @brief Keyed dispatch with per-key FIFO order and parallel consumers.
+     *
+     * Every key maps to a strand, Key % TStrandCount, with its own small ring. A strand is scheduled on a shared
+     * ready queue when its first message arrives and runs on at most one worker at a time, so messages for one key
+     * are handled in Post order while different strands run in parallel on however many workers call RunReady.
+     * Keys that share a strand are also ordered relative to each other.
+     *
+     * With TSingleProducerPerStrand the strand rings are SPSC. Several keys share each strand, so only turn it on
+     * when every strand, not just every key, is posted to by a single thread, e.g. one producer thread overall.
+     */
+    template<typename T, uint TStrandCount, uint TStrandBufferSize = 64, bool TSingleProducerPerStrand = false>
+    class TStrandQueue
+    {
+        static_assert(TStrandCount > 0,                                        "No strands!");
+
+        using FElementType      = T;
+        using FStrandBuffer     = TBoundedCircularQueue<FElementType, TStrandBufferSize, true, true, TSingleProducerPerStrand>;
+
+        static constexpr uint   InvalidStrand = ~0U;
+
+        /* Pending counts messages posted but not yet handled, the strand is on the ready queue while it is above 0. */
+        struct CACHE_ALIGN FStrand
+        {
+            FStrandBuffer                   Buffer;
+            CACHE_ALIGN std::atomic<uint32> Pending;
+        };
+
+        using FReadyQueue       = TBoundedCircularAtomicQueueHeap<uint, TStrandCount, InvalidStrand>;
+
+    public:
+        TStrandQueue() noexcept(Q_NOEXCEPT_ENABLED)
+            : Strands(new FStrand[TStrandCount]())
+        {
+        }
+
+        TStrandQueue(const TStrandQueue&)               = delete;
+        TStrandQueue& operator=(const TStrandQueue&)    = delete;
+
+        FORCEINLINE uint StrandCount() const noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            return TStrandCount;
+        }
+
+        FORCEINLINE uint StrandOf(const uint Key) const noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            return Key % TStrandCount;
+        }
+
+        /**
+         * Queues NewElement on Key's strand, waiting for room if its ring is full. Must not be called from a
+         * RunReady visitor for the strand being run, that strand's ring only drains once the visitor returns.
+         */
+        FORCEINLINE void Post(const uint Key, const FElementType& NewElement) noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            const uint StrandIndex = StrandOf(Key);
+            Strands[StrandIndex].Buffer.Push(NewElement);
+            OnPosted(StrandIndex);
+        }
+
+        /** Queues NewElement on Key's strand, returns false if its ring is full. */
+        FORCEINLINE bool TryPost(const uint Key, const FElementType& NewElement) noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            const uint StrandIndex = StrandOf(Key);
+            if(!Strands[StrandIndex].Buffer.TryPush(NewElement))
+            {
+                return false;
+            }
+            OnPosted(StrandIndex);
+            return true;
+        }
+
+        /**
+         * Runs one ready strand, calling Visitor(Message) for up to MaxBatch of its messages in order, and puts it
+         * back on the ready queue if more are pending. Returns how many messages were handled, 0 if no strand was
+         * ready. Any number of workers may call this concurrently.
+         */
+        template<typename TVisitor>
+        FORCEINLINE uint RunReady(const TVisitor& Visitor, const uint MaxBatch = 32) noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            uint StrandIndex = InvalidStrand;
+            if(!ReadyStrands.TryPop(StrandIndex))
+            {
+                return 0;
+            }
+
+            // Only count messages whose Post finished, those are guaranteed to be in the ring.
+            FStrand& Strand = Strands[StrandIndex];
+            const uint32 Available = Strand.Pending.load(Utils::ACQUIRE);
+            const uint32 BatchSize = Available < MaxBatch ? Available : MaxBatch;
+            for(uint32 i = 0; i < BatchSize; ++i)
+            {
+                Visitor(Strand.Buffer.Pop());
+            }
+
+            // Hands the strand, and our writes to its state, to whichever worker runs it next.
+            if(Strand.Pending.fetch_sub(BatchSize, Utils::ACQ_REL) != BatchSize)
+            {
+                ReadyStrands.Push(StrandIndex);
+            }
+            return BatchSize;
+        }
+
+        FORCEINLINE bool WasEmpty() const noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            return ReadyStrands.WasEmpty();
+        }
+
+    private:
+        FORCEINLINE void OnPosted(const uint StrandIndex) noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            // A strand is queued at most once, so the ready queue can never fill up.
+            if(Strands[StrandIndex].Pending.fetch_add(1, Utils::ACQ_REL) == 0)
+            {
+                ReadyStrands.Push(StrandIndex);
+            }
+        }
+
+        std::unique_ptr<FStrand[]>      Strands;
+        FReadyQueue                     ReadyStrands;
+    };
+} // AtomicQueue namespace
+
+#undef CACHE_ALIGN
+#undef Q_NOEXCEPT_ENABLED
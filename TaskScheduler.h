@@ -0,0 +1,448 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#if defined(_WIN32)
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+#elif defined(__linux__)
+    #include <pthread.h>
+    #include <sched.h>
+#endif
+
+#include "Queue.h"
+
+#define CACHE_ALIGN alignas(PLATFORM_CACHE_LINE_SIZE)
+#define Q_NOEXCEPT_ENABLED true
+
+namespace AtomicQueue
+{
+    /**
+     * @brief What an idle worker does between looking for tasks.
+     */
+    enum class EWorkerWaitPolicy : uint8
+    {
+        SPIN,   // Busy-wait with a pause instruction, lowest wake latency, burns the core.
+        YIELD,  // Give the rest of the time slice back to the OS scheduler.
+        PARK    // Spin for a short while, then sleep until a task is spawned.
+    };
+
+    /**
+     * @brief Fork/join completion counter. Spawn adds to it, the worker that ran the task counts it down.
+     */
+    struct CACHE_ALIGN FTaskLatch
+    {
+        explicit FTaskLatch(const uint32 InCount = 0) noexcept(Q_NOEXCEPT_ENABLED)
+            : Count{InCount}
+        {
+        }
+
+        FTaskLatch(const FTaskLatch&)               = delete;
+        FTaskLatch& operator=(const FTaskLatch&)    = delete;
+
+        FORCEINLINE void Add(const uint32 Amount = 1) noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            Count.fetch_add(Amount, Utils::RELAXED);
+        }
+
+        FORCEINLINE void CountDown() noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            Count.fetch_sub(1, Utils::RELEASE);
+        }
+
+        FORCEINLINE bool IsDone() const noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            return Count.load(Utils::ACQUIRE) == 0;
+        }
+
+    private:
+        std::atomic<uint32>     Count;
+    };
+
+    struct FTask
+    {
+        void                    (*Function)(void*) = nullptr;
+        void*                   Context = nullptr;
+        FTaskLatch*             Latch = nullptr;
+    };
+
+    /**
+     * @brief Fixed pool of pinned worker threads fed by the bounded queues.
+     *
+     * Tasks spawned from outside the pool go to one MPMC injection queue, tasks spawned by a worker go to that
+     * worker's own queue. Idle workers drain their own queue first, then the injection queue, then steal from the
+     * other workers. A spawn that finds its queues full runs the task in place instead of blocking.
+     *
+     * Destruction runs every task still queued, and any task those spawn, before it returns, so no latch is left
+     * short. Spawning from outside the pool must have finished by then.
+     */
+    template<uint TGlobalQueueSize = 4096, uint TLocalQueueSize = 512>
+    class TTaskScheduler
+    {
+        using FGlobalQueue      = TBoundedCircularQueue<FTask, TGlobalQueueSize>;
+        using FLocalQueue       = TBoundedCircularQueue<FTask, TLocalQueueSize>;
+
+        static constexpr uint32 ParkSpinCount = 256;
+
+        struct CACHE_ALIGN FWorker
+        {
+            FLocalQueue         LocalQueue;
+            std::thread         Thread;
+        };
+
+        struct FThreadContext
+        {
+            const TTaskScheduler*   Scheduler = nullptr;
+            uint32                  WorkerIndex = 0;
+        };
+
+        template<typename TBody>
+        struct TParallelForState
+        {
+            const TBody*            Body;
+            std::atomic<uint32>     NextIndex;
+            uint32                  Count;
+            uint32                  MinChunkSize;
+            uint32                  ChunkDivisor;
+        };
+
+    public:
+        /**
+         * @param InWorkerCount Number of worker threads, zero for one per hardware thread minus the caller's.
+         * @param bPinWorkers Pin worker N to core N + 1, leaving core 0 to the thread that owns the scheduler.
+         */
+        explicit TTaskScheduler(const uint32 InWorkerCount = 0,
+            const EWorkerWaitPolicy InWaitPolicy = EWorkerWaitPolicy::PARK, const bool bPinWorkers = true)
+            : WorkerCount(InWorkerCount ? InWorkerCount : DefaultWorkerCount()),
+            WaitPolicy(InWaitPolicy),
+            Workers(new FWorker[WorkerCount]),
+            bStopping{false},
+            Sleepers{0},
+            WakeEpoch{0}
+        {
+            const uint32 CoreCount = std::thread::hardware_concurrency();
+            for(uint32 i = 0; i < WorkerCount; ++i)
+            {
+                Workers[i].Thread = std::thread([this, i](){ WorkerMain(i); });
+                if(bPinWorkers && CoreCount > 1)
+                {
+                    PinThreadToCore(Workers[i].Thread, (i + 1) % CoreCount);
+                }
+            }
+        }
+
+        ~TTaskScheduler() noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            {
+                std::lock_guard<std::mutex> Lock(WakeMutex);
+                bStopping.store(true, Utils::RELAXED);
+                WakeEpoch.fetch_add(1, Utils::RELAXED);
+            }
+            WakeCondition.notify_all();
+
+            for(uint32 i = 0; i < WorkerCount; ++i)
+            {
+                Workers[i].Thread.join();
+            }
+
+            // Workers drain before exiting, this only catches a task a racing TryPop skipped on the way out.
+            FTask Task;
+            while(TryGetTask(WorkerCount, Task))
+            {
+                RunTask(Task);
+            }
+        }
+
+        TTaskScheduler(const TTaskScheduler&)               = delete;
+        TTaskScheduler& operator=(const TTaskScheduler&)    = delete;
+
+        FORCEINLINE uint32 NumWorkers() const noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            return WorkerCount;
+        }
+
+        /** Queues Function(Context). If Latch is set it is counted up now and down once the task has run. */
+        void Spawn(void (*Function)(void*), void* Context, FTaskLatch* Latch = nullptr) noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            FTask Task;
+            Task.Function = Function;
+            Task.Context = Context;
+            Task.Latch = Latch;
+            if(Latch)
+            {
+                Latch->Add();
+            }
+
+            const uint32 WorkerIndex = CurrentWorkerIndex();
+            if(!(WorkerIndex < WorkerCount && Workers[WorkerIndex].LocalQueue.TryPush(Task)) && !GlobalQueue.TryPush(Task))
+            {
+                RunTask(Task);
+                return;
+            }
+            WakeWorker();
+        }
+
+        /** Runs queued tasks on the calling thread until Latch reaches zero, so waiting from a worker can't deadlock. */
+        void Wait(const FTaskLatch& Latch) noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            const uint32 WorkerIndex = CurrentWorkerIndex();
+            while(!Latch.IsDone())
+            {
+                FTask Task;
+                if(TryGetTask(WorkerIndex, Task))
+                {
+                    RunTask(Task);
+                }
+                else
+                {
+                    Utils::SpinLoopPause();
+                }
+            }
+        }
+
+        /**
+         * Calls Body(Index) for every Index in [0, Count) on the workers and the calling thread, returns once all
+         * calls are done. Chunks are claimed with guided scheduling: each claim takes a share of what is left, so
+         * early chunks are large to keep the claim overhead low and late chunks are small to balance the tail.
+         */
+        template<typename TBody>
+        void ParallelFor(const uint32 Count, const TBody& Body, const uint32 MinChunkSize = 1) noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            if(Count == 0)
+            {
+                return;
+            }
+
+            TParallelForState<TBody> State;
+            State.Body = &Body;
+            State.NextIndex.store(0, Utils::RELAXED);
+            State.Count = Count;
+            State.MinChunkSize = MinChunkSize ? MinChunkSize : 1;
+            State.ChunkDivisor = (WorkerCount + 1) * 2;
+
+            const uint32 ChunkCount = (Count + State.MinChunkSize - 1) / State.MinChunkSize;
+            const uint32 HelperCount = ChunkCount - 1 < WorkerCount ? ChunkCount - 1 : WorkerCount;
+
+            FTaskLatch Latch;
+            for(uint32 i = 0; i < HelperCount; ++i)
+            {
+                Spawn(&RunParallelForChunks<TBody>, &State, &Latch);
+            }
+            RunParallelForChunks<TBody>(&State);
+            Wait(Latch);
+        }
+
+    private:
+        static uint32 DefaultWorkerCount() noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            const uint32 CoreCount = std::thread::hardware_concurrency();
+            return CoreCount > 1 ? CoreCount - 1 : 1;
+        }
+
+        static void PinThreadToCore(std::thread& Thread, const uint32 Core) noexcept(Q_NOEXCEPT_ENABLED)
+        {
+#if defined(_WIN32)
+            SetThreadAffinityMask(static_cast<HANDLE>(Thread.native_handle()), static_cast<DWORD_PTR>(1) << (Core % 64));
+#elif defined(__linux__)
+            cpu_set_t CoreSet;
+            CPU_ZERO(&CoreSet);
+            CPU_SET(Core, &CoreSet);
+            pthread_setaffinity_np(Thread.native_handle(), sizeof(cpu_set_t), &CoreSet);
+#else
+            (void)Thread;
+            (void)Core;
+#endif
+        }
+
+        static FThreadContext& ThreadContext() noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            static thread_local FThreadContext Context;
+            return Context;
+        }
+
+        /** This thread's worker index, or WorkerCount for threads outside the pool. */
+        FORCEINLINE uint32 CurrentWorkerIndex() const noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            const FThreadContext& Context = ThreadContext();
+            return Context.Scheduler == this ? Context.WorkerIndex : WorkerCount;
+        }
+
+        static FORCEINLINE void RunTask(const FTask& Task) noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            Task.Function(Task.Context);
+            if(Task.Latch)
+            {
+                Task.Latch->CountDown();
+            }
+        }
+
+        FORCEINLINE bool TryGetTask(const uint32 WorkerIndex, FTask& OutTask) noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            if(WorkerIndex < WorkerCount && Workers[WorkerIndex].LocalQueue.TryPop(OutTask))
+            {
+                return true;
+            }
+            if(GlobalQueue.TryPop(OutTask))
+            {
+                return true;
+            }
+            for(uint32 i = 1; i <= WorkerCount; ++i)
+            {
+                const uint32 VictimIndex = (WorkerIndex + i) % WorkerCount;
+                if(VictimIndex != WorkerIndex && Workers[VictimIndex].LocalQueue.TryPop(OutTask))
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool HasQueuedTasks() const noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            if(!GlobalQueue.WasEmpty())
+            {
+                return true;
+            }
+            for(uint32 i = 0; i < WorkerCount; ++i)
+            {
+                if(!Workers[i].LocalQueue.WasEmpty())
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        FORCEINLINE void WakeWorker() noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            if(WaitPolicy != EWorkerWaitPolicy::PARK)
+            {
+                return;
+            }
+
+            // Pairs with the Sleepers increment in Park: either the sleeper sees the task or we see the sleeper.
+            std::atomic_thread_fence(Utils::SEQ_CONST);
+            if(Sleepers.load(Utils::RELAXED) > 0)
+            {
+                {
+                    std::lock_guard<std::mutex> Lock(WakeMutex);
+                    WakeEpoch.fetch_add(1, Utils::RELAXED);
+                }
+                WakeCondition.notify_one();
+            }
+        }
+
+        void Park() noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            const uint32 Epoch = WakeEpoch.load(Utils::ACQUIRE);
+            Sleepers.fetch_add(1, Utils::SEQ_CONST);
+
+            // HasQueuedTasks only does relaxed loads, the fence keeps them after the increment on weakly ordered CPUs.
+            std::atomic_thread_fence(Utils::SEQ_CONST);
+            if(!HasQueuedTasks())
+            {
+                std::unique_lock<std::mutex> Lock(WakeMutex);
+                WakeCondition.wait(Lock, [this, Epoch]()
+                {
+                    return WakeEpoch.load(Utils::RELAXED) != Epoch || bStopping.load(Utils::RELAXED);
+                });
+            }
+            Sleepers.fetch_sub(1, Utils::RELAXED);
+        }
+
+        void WorkerMain(const uint32 WorkerIndex) noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            FThreadContext& Context = ThreadContext();
+            Context.Scheduler = this;
+            Context.WorkerIndex = WorkerIndex;
+
+            uint32 IdleCount = 0;
+            while(!bStopping.load(Utils::RELAXED))
+            {
+                FTask Task;
+                if(TryGetTask(WorkerIndex, Task))
+                {
+                    RunTask(Task);
+                    IdleCount = 0;
+                    continue;
+                }
+
+                switch(WaitPolicy)
+                {
+                case EWorkerWaitPolicy::SPIN:
+                    Utils::SpinLoopPause();
+                    break;
+                case EWorkerWaitPolicy::YIELD:
+                    std::this_thread::yield();
+                    break;
+                case EWorkerWaitPolicy::PARK:
+                    if(++IdleCount < ParkSpinCount)
+                    {
+                        Utils::SpinLoopPause();
+                    }
+                    else
+                    {
+                        Park();
+                        IdleCount = 0;
+                    }
+                    break;
+                }
+            }
+
+            // Run whatever is still queued, spawns from these tasks land in queues this loop also checks.
+            FTask Task;
+            while(TryGetTask(WorkerIndex, Task))
+            {
+                RunTask(Task);
+            }
+
+            Context.Scheduler = nullptr;
+        }
+
+        template<typename TBody>
+        static void RunParallelForChunks(void* Context) noexcept(Q_NOEXCEPT_ENABLED)
+        {
+            TParallelForState<TBody>& State = *static_cast<TParallelForState<TBody>*>(Context);
+
+            uint32 Begin = State.NextIndex.load(Utils::RELAXED);
+            while(Begin < State.Count)
+            {
+                const uint32 Remaining = State.Count - Begin;
+                uint32 ChunkSize = Remaining / State.ChunkDivisor;
+                ChunkSize = ChunkSize < State.MinChunkSize ? State.MinChunkSize : ChunkSize;
+                ChunkSize = ChunkSize > Remaining ? Remaining : ChunkSize;
+
+                if(!State.NextIndex.compare_exchange_weak(Begin, Begin + ChunkSize, Utils::RELAXED, Utils::RELAXED))
+                {
+                    continue;
+                }
+
+                for(uint32 Index = Begin; Index < Begin + ChunkSize; ++Index)
+                {
+                    (*State.Body)(Index);
+                }
+                Begin = State.NextIndex.load(Utils::RELAXED);
+            }
+        }
+
+        const uint32                    WorkerCount;
+        const EWorkerWaitPolicy         WaitPolicy;
+        std::unique_ptr<FWorker[]>      Workers;
+        FGlobalQueue                    GlobalQueue;
+
+        CACHE_ALIGN std::atomic<bool>   bStopping;
+        CACHE_ALIGN std::atomic<uint32> Sleepers;
+        std::atomic<uint32>             WakeEpoch;
+        std::mutex                      WakeMutex;
+        std::condition_variable         WakeCondition;
+    };
+} // AtomicQueue namespace
+
+#undef CACHE_ALIGN
+#undef Q_NOEXCEPT_ENABLED
@@ -1,7 +1,23 @@
+#include <algorithm>
 #include <thread>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <vector>
 
 #include "Queue.h"
+#include "ObjectPool.h"
+#include "QueueTuner.h"
+#include "ReferenceQueues.h"
+#include "QueueSet.h"
+#include "StrandQueue.h"
+#include "TaskScheduler.h"
 
 #define CORE_COUNT 8
 #define ELEMENTS_TO_PROCESS         (6000000 / CORE_COUNT)
@@ -9,19 +25,64 @@
 
 #define QueueVar                      MyQueue
 #define PushFunction(_ELEMENT_)       QueueVar.Push((_ELEMENT_))
-#define PopFunction(_ELEMENT_)        (_ELEMENT_) = QueueVar.Pop() 
+#define PopFunction(_ELEMENT_)        (_ELEMENT_) = QueueVar.Pop()
 
 #define BENCH_SLEEP_UNIT(_SLEEP_LENGTH_) std::chrono::milliseconds((_SLEEP_LENGTH_))
 #define BENCH_SLEEP_LENGTH 1
 
+#define TRACE_BENCH_QUEUE_SIZE      1024
+#define TRACE_BENCH_OPS             20000000
+#define TRACE_BENCH_OUTPUT          "sojourn_trace.json"
+
+#define SCHEDULER_BENCH_TASKS       20000
+#define SCHEDULER_BENCH_TASK_WORK   64
+#define PARALLEL_FOR_BENCH_COUNT    (1 << 22)
+
+#define POOL_BENCH_THREADS          4
+#define POOL_BENCH_MESSAGES         1000000
+#define POOL_BENCH_QUEUE_SIZE       16384
+#define POOL_BENCH_CAPACITY         65536
+
+#define CONFLATE_BENCH_PRODUCERS    4
+#define CONFLATE_BENCH_UPDATES      250000
+#define CONFLATE_BENCH_KEYS         1024
+#define CONFLATE_BENCH_APPLY_WORK   256
+
+#define QUEUESET_BENCH_PRODUCERS    4
+#define QUEUESET_BENCH_MESSAGES     20000
+#define QUEUESET_BENCH_BURST        16
+#define QUEUESET_BENCH_QUEUE_SIZE   1024
+
+#define COMBINING_BENCH_MAX_THREADS 32
+#define COMBINING_BENCH_OPS         2000000
+#define COMBINING_BENCH_QUEUE_SIZE  4096
+
+#define STRAND_BENCH_WORKERS        4
+#define STRAND_BENCH_KEYS           1024
+#define STRAND_BENCH_MESSAGES       1000000
+#define STRAND_BENCH_WORK           128
+#define STRAND_BENCH_BATCH          32
+
+#define TUNE_BENCH_ELEMENTS         200000
+#define TUNE_BENCH_REPETITIONS      3
+#define TUNE_BENCH_OUTPUT           "TunedQueues.h"
+
+#define REFERENCE_BENCH_ELEMENTS    400000
+#define REFERENCE_BENCH_REPETITIONS 3
+
 using FBenchType = int;
 
 namespace QBenchmarks
 {
-    static TBoundedCircularQueue<FBenchType, BENCH_QUEUE_SIZE, true, true, false> MyQueue;
+    static AtomicQueue::TBoundedCircularQueue<FBenchType, BENCH_QUEUE_SIZE, true, true, false> MyQueue;
 
     static std::atomic<int> ThreadsComplete = {0};
 
+    static FORCEINLINE double SecondsSince(const std::chrono::steady_clock::time_point Start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+    }
+
     static FORCEINLINE void WaitForCompletion(const int ThreadCount)
     {
         while(ThreadsComplete.load(std::memory_order_relaxed) < ThreadCount)
@@ -30,7 +91,7 @@ namespace QBenchmarks
         }
         ThreadsComplete.store(0);
     }
-    
+
     static FORCEINLINE void NoDelayHighContentionRegular(const int ThreadCount, const int CycleCount,
         std::memory_order MemoryOrder = std::memory_order_acquire)
     {
@@ -59,11 +120,867 @@ namespace QBenchmarks
 
         WaitForCompletion(ThreadCount * 2);
     }
+
+    /** Push/Pop pairs on one thread, so the only difference between the runs is the trace hook cost. */
+    template<typename TQueue>
+    static double UncontendedNanosecondsPerOp(TQueue& Queue, const int OpCount)
+    {
+        FBenchType Sink = 0;
+        const auto Start = std::chrono::steady_clock::now();
+        for(int i = 0; i < OpCount; ++i)
+        {
+            Queue.Push(i);
+            Sink += Queue.Pop();
+        }
+        const double Seconds = SecondsSince(Start);
+
+        // Keep the loop from being optimized away.
+        if(Sink == 1)
+        {
+            printf(" ");
+        }
+        return Seconds * 1e9 / (OpCount * 2.0);
+    }
+
+    static AtomicQueue::TBoundedCircularQueue<FBenchType, TRACE_BENCH_QUEUE_SIZE, true, true, false, false> UntracedQueue;
+    static AtomicQueue::TBoundedCircularQueue<FBenchType, TRACE_BENCH_QUEUE_SIZE, true, true, false, true> TracedQueue;
+    static AtomicQueue::TBoundedCircularQueue<FBenchType, TRACE_BENCH_QUEUE_SIZE, true, true, false, true> TracedContendedQueue;
+
+    static void SojournTraceOverhead(const int ThreadCount, const int CycleCount)
+    {
+        TracedQueue.SetTraceName("Uncontended");
+        TracedContendedQueue.SetTraceName("Contended");
+
+        AtomicQueue::Trace::SetSampleRate(0.0);
+        const double Untraced = UncontendedNanosecondsPerOp(UntracedQueue, TRACE_BENCH_OPS);
+        const double SamplingOff = UncontendedNanosecondsPerOp(TracedQueue, TRACE_BENCH_OPS);
+        AtomicQueue::Trace::SetSampleRate(0.01);
+        const double SamplingOnePercent = UncontendedNanosecondsPerOp(TracedQueue, TRACE_BENCH_OPS);
+
+        printf("untraced:            %.2f ns/op\n", Untraced);
+        printf("traced, sampling 0%%: %.2f ns/op\n", SamplingOff);
+        printf("traced, sampling 1%%: %.2f ns/op\n", SamplingOnePercent);
+
+        for(int i = 0; i < ThreadCount; ++i)
+        {
+            std::thread([&]() // producer
+            {
+                for(int j = 0; j < CycleCount; ++j)
+                {
+                    TracedContendedQueue.Push(j);
+                }
+                ThreadsComplete.fetch_add(1);
+            }).detach();
+
+            std::thread([&]() // consumer
+            {
+                for(int j = 0; j < CycleCount; ++j)
+                {
+                    TracedContendedQueue.Pop();
+                }
+                ThreadsComplete.fetch_add(1);
+            }).detach();
+        }
+        WaitForCompletion(ThreadCount * 2);
+
+        AtomicQueue::Trace::WriteSummary(stdout);
+        if(!AtomicQueue::Trace::WriteChromeTrace(TRACE_BENCH_OUTPUT))
+        {
+            printf("failed to write %s\n", TRACE_BENCH_OUTPUT);
+        }
+    }
+
+    /** Reference pool for the scheduler benchmark: one mutex, one condition variable, one std::deque. */
+    class FMutexThreadPool
+    {
+    public:
+        explicit FMutexThreadPool(const uint32 WorkerCount)
+        {
+            for(uint32 i = 0; i < WorkerCount; ++i)
+            {
+                Workers.emplace_back([this]() { WorkerMain(); });
+            }
+        }
+
+        ~FMutexThreadPool()
+        {
+            {
+                std::lock_guard<std::mutex> Lock(Mutex);
+                bStopping = true;
+            }
+            TaskAdded.notify_all();
+            for(std::thread& Worker : Workers)
+            {
+                Worker.join();
+            }
+        }
+
+        void Submit(std::function<void()> Task)
+        {
+            {
+                std::lock_guard<std::mutex> Lock(Mutex);
+                Tasks.push_back(std::move(Task));
+                ++PendingCount;
+            }
+            TaskAdded.notify_one();
+        }
+
+        void WaitIdle()
+        {
+            std::unique_lock<std::mutex> Lock(Mutex);
+            AllDone.wait(Lock, [this]() { return PendingCount == 0; });
+        }
+
+    private:
+        void WorkerMain()
+        {
+            for(;;)
+            {
+                std::function<void()> Task;
+                {
+                    std::unique_lock<std::mutex> Lock(Mutex);
+                    TaskAdded.wait(Lock, [this]() { return bStopping || !Tasks.empty(); });
+                    if(Tasks.empty())
+                    {
+                        return;
+                    }
+                    Task = std::move(Tasks.front());
+                    Tasks.pop_front();
+                }
+
+                Task();
+
+                std::lock_guard<std::mutex> Lock(Mutex);
+                if(--PendingCount == 0)
+                {
+                    AllDone.notify_all();
+                }
+            }
+        }
+
+        std::vector<std::thread>            Workers;
+        std::deque<std::function<void()>>   Tasks;
+        std::mutex                          Mutex;
+        std::condition_variable             TaskAdded;
+        std::condition_variable             AllDone;
+        uint64                              PendingCount = 0;
+        bool                                bStopping = false;
+    };
+
+    static std::atomic<uint64> TaskWorkSink = {0};
+
+    static void FineGrainedTask(void*)
+    {
+        uint64 Value = 0;
+        for(uint64 i = 0; i < SCHEDULER_BENCH_TASK_WORK; ++i)
+        {
+            Value = (Value ^ i) * 0x9E3779B97F4A7C15ull;
+        }
+        TaskWorkSink.fetch_add(Value, std::memory_order_relaxed);
+    }
+
+    static void SchedulerFineGrainedTasks(const int TaskCount)
+    {
+        {
+            AtomicQueue::TTaskScheduler<> Scheduler;
+            AtomicQueue::FTaskLatch Latch;
+            const auto Start = std::chrono::steady_clock::now();
+            for(int i = 0; i < TaskCount; ++i)
+            {
+                Scheduler.Spawn(&FineGrainedTask, nullptr, &Latch);
+            }
+            Scheduler.Wait(Latch);
+            printf("TTaskScheduler:      %.3f us/task (%u workers)\n",
+                SecondsSince(Start) * 1e6 / TaskCount, Scheduler.NumWorkers());
+
+            std::vector<uint64> Values(PARALLEL_FOR_BENCH_COUNT);
+            const auto SerialStart = std::chrono::steady_clock::now();
+            for(uint32 i = 0; i < PARALLEL_FOR_BENCH_COUNT; ++i)
+            {
+                Values[i] = i * 0x9E3779B97F4A7C15ull;
+            }
+            const double Serial = SecondsSince(SerialStart);
+
+            const auto ParallelStart = std::chrono::steady_clock::now();
+            Scheduler.ParallelFor(PARALLEL_FOR_BENCH_COUNT, [&Values](const uint32 Index)
+            {
+                Values[Index] = Index * 0x9E3779B97F4A7C15ull;
+            }, 1024);
+            printf("ParallelFor:         %.3f ms (serial %.3f ms)\n", SecondsSince(ParallelStart) * 1e3, Serial * 1e3);
+        }
+
+        {
+            const uint32 CoreCount = std::thread::hardware_concurrency();
+            FMutexThreadPool Pool(CoreCount > 1 ? CoreCount - 1 : 1);
+            const auto Start = std::chrono::steady_clock::now();
+            for(int i = 0; i < TaskCount; ++i)
+            {
+                Pool.Submit([]() { FineGrainedTask(nullptr); });
+            }
+            Pool.WaitIdle();
+            printf("mutex/condvar pool:  %.3f us/task\n", SecondsSince(Start) * 1e6 / TaskCount);
+        }
+
+        {
+            std::vector<std::future<void>> Futures;
+            Futures.reserve(TaskCount);
+            const auto Start = std::chrono::steady_clock::now();
+            for(int i = 0; i < TaskCount; ++i)
+            {
+                Futures.push_back(std::async(std::launch::async, []() { FineGrainedTask(nullptr); }));
+            }
+            for(std::future<void>& Future : Futures)
+            {
+                Future.wait();
+            }
+            printf("std::async:          %.3f us/task\n", SecondsSince(Start) * 1e6 / TaskCount);
+        }
+    }
+}
+
+namespace QBenchmarks
+{
+    struct FBenchMessage
+    {
+        uint64 Payload[6];
+    };
+
+    static AtomicQueue::TBoundedCircularAtomicQueueHeap<FBenchMessage*, POOL_BENCH_QUEUE_SIZE> MessageQueue;
+    static AtomicQueue::TObjectPool<FBenchMessage, POOL_BENCH_CAPACITY> MessagePool;
+    static std::atomic<uint64> MessageSink = {0};
+
+    /** N producers allocate messages and send them through MessageQueue to N consumers, which free them. */
+    template<bool TUsePool>
+    static double MessageChurnSeconds(const int ThreadCount, const int MessageCount)
+    {
+        const auto Start = std::chrono::steady_clock::now();
+        for(int i = 0; i < ThreadCount; ++i)
+        {
+            std::thread([&]() // producer
+            {
+                for(int j = 0; j < MessageCount; ++j)
+                {
+                    FBenchMessage* Message = TUsePool ? MessagePool.Allocate() : new FBenchMessage();
+                    while(!Message)
+                    {
+                        std::this_thread::yield();
+                        Message = MessagePool.Allocate();
+                    }
+                    Message->Payload[0] = j;
+                    MessageQueue.Push(Message);
+                }
+                if(TUsePool)
+                {
+                    MessagePool.FlushThreadCache();
+                }
+                ThreadsComplete.fetch_add(1);
+            }).detach();
+
+            std::thread([&]() // consumer
+            {
+                uint64 Sum = 0;
+                for(int j = 0; j < MessageCount; ++j)
+                {
+                    FBenchMessage* Message = MessageQueue.Pop();
+                    Sum += Message->Payload[0];
+                    if(TUsePool)
+                    {
+                        MessagePool.Free(Message);
+                    }
+                    else
+                    {
+                        delete Message;
+                    }
+                }
+                if(TUsePool)
+                {
+                    MessagePool.FlushThreadCache();
+                }
+                MessageSink.fetch_add(Sum, std::memory_order_relaxed);
+                ThreadsComplete.fetch_add(1);
+            }).detach();
+        }
+
+        WaitForCompletion(ThreadCount * 2);
+        return SecondsSince(Start);
+    }
+
+    static void ObjectPoolChurn(const int ThreadCount, const int MessageCount)
+    {
+        const double TotalMessages = static_cast<double>(ThreadCount) * MessageCount;
+        printf("new/delete:   %.1f ns/message\n", MessageChurnSeconds<false>(ThreadCount, MessageCount) * 1e9 / TotalMessages);
+        printf("TObjectPool:  %.1f ns/message\n", MessageChurnSeconds<true>(ThreadCount, MessageCount) * 1e9 / TotalMessages);
+    }
+}
+
+namespace QBenchmarks
+{
+    struct FStateUpdate
+    {
+        uint32 ActorId;
+        float Location[3];
+    };
+
+    static AtomicQueue::TBoundedCircularQueue<FStateUpdate, 65536> UpdateQueue;
+    static AtomicQueue::TConflatingQueue<FStateUpdate, CONFLATE_BENCH_KEYS> ConflatingUpdateQueue;
+    static std::atomic<int> ProducersComplete = {0};
+
+    /** Stands in for the consumer's cost of applying one replicated state update. */
+    static FORCEINLINE void ApplyStateUpdate(const FStateUpdate& Update)
+    {
+        uint64 Value = Update.ActorId;
+        for(uint64 i = 0; i < CONFLATE_BENCH_APPLY_WORK; ++i)
+        {
+            Value = (Value ^ i) * 0x9E3779B97F4A7C15ull;
+        }
+        TaskWorkSink.fetch_add(Value, std::memory_order_relaxed);
+    }
+
+    template<typename TPushFunction>
+    static void StartUpdateProducers(const int ProducerCount, const int UpdateCount, const TPushFunction& PushUpdate)
+    {
+        for(int i = 0; i < ProducerCount; ++i)
+        {
+            std::thread([=]()
+            {
+                for(int j = 0; j < UpdateCount; ++j)
+                {
+                    FStateUpdate Update;
+                    // Producer i owns the actors congruent to i, TConflatingQueue takes one producer per key.
+                    Update.ActorId = (j * 7919) % (CONFLATE_BENCH_KEYS / ProducerCount) * ProducerCount + i;
+                    Update.Location[0] = Update.Location[1] = Update.Location[2] = static_cast<float>(j);
+                    PushUpdate(Update);
+                }
+                ProducersComplete.fetch_add(1);
+            }).detach();
+        }
+    }
+
+    static void ConflatingStateReplication(const int ProducerCount, const int UpdateCount)
+    {
+        {
+            ProducersComplete.store(0);
+            const auto Start = std::chrono::steady_clock::now();
+            StartUpdateProducers(ProducerCount, UpdateCount, [](const FStateUpdate& Update) { UpdateQueue.Push(Update); });
+            for(int i = 0; i < ProducerCount * UpdateCount; ++i)
+            {
+                ApplyStateUpdate(UpdateQueue.Pop());
+            }
+            printf("TBoundedCircularQueue: applied %d updates in %.1f ms\n",
+                ProducerCount * UpdateCount, SecondsSince(Start) * 1e3);
+
+            // A late increment from this run would end the next run's drain early.
+            while(ProducersComplete.load() != ProducerCount)
+            {
+                std::this_thread::yield();
+            }
+        }
+
+        {
+            ProducersComplete.store(0);
+            const auto Start = std::chrono::steady_clock::now();
+            StartUpdateProducers(ProducerCount, UpdateCount, [](const FStateUpdate& Update)
+            {
+                ConflatingUpdateQueue.Push(Update.ActorId, Update);
+            });
+
+            int Applied = 0;
+            for(;;)
+            {
+                const bool bProducersDone = ProducersComplete.load() == ProducerCount;
+                const uint Drained = ConflatingUpdateQueue.Drain([](const uint, const FStateUpdate& Update)
+                {
+                    ApplyStateUpdate(Update);
+                });
+                Applied += Drained;
+                if(Drained == 0 && bProducersDone)
+                {
+                    break;
+                }
+            }
+            printf("TConflatingQueue:      applied %d updates in %.1f ms\n", Applied, SecondsSince(Start) * 1e3);
+        }
+    }
+}
+
+namespace QBenchmarks
+{
+    using FQueueSetBenchQueue = AtomicQueue::TBoundedCircularQueue<uint64, QUEUESET_BENCH_QUEUE_SIZE>;
+    using FQueueSetBenchMember = AtomicQueue::TQueueSetMember<FQueueSetBenchQueue>;
+
+    static FQueueSetBenchQueue SetBenchQueues[AtomicQueue::FQueueSet::MaxQueues];
+
+    static FORCEINLINE uint64 NowNanoseconds()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    /** Producers push bursts of timestamps into random queues, idling between bursts like an IO thread's sources. */
+    template<typename TPushFunction>
+    static void StartBurstProducers(const int ProducerCount, const int MessageCount, const uint32 QueueCount, const TPushFunction& PushMessage)
+    {
+        for(int i = 0; i < ProducerCount; ++i)
+        {
+            std::thread([=]()
+            {
+                uint32 Random = 0x9E3779B9u * (i + 1);
+                for(int j = 0; j < MessageCount; ++j)
+                {
+                    Random = Random * 1664525u + 1013904223u;
+                    PushMessage((Random >> 8) % QueueCount, NowNanoseconds());
+                    if(j % QUEUESET_BENCH_BURST == QUEUESET_BENCH_BURST - 1)
+                    {
+                        std::this_thread::sleep_for(std::chrono::microseconds(50));
+                    }
+                }
+                ProducersComplete.fetch_add(1);
+            }).detach();
+        }
+    }
+
+    static void QueueSetVersusPolling(const int ProducerCount, const int MessageCount)
+    {
+        const uint32 QueueCounts[] = {4, 16, 64};
+        const uint64 TotalMessages = static_cast<uint64>(ProducerCount) * MessageCount;
+
+        for(const uint32 QueueCount : QueueCounts)
+        {
+            {
+                ProducersComplete.store(0);
+                const auto Start = std::chrono::steady_clock::now();
+                StartBurstProducers(ProducerCount, MessageCount, QueueCount, [](const uint32 Queue, const uint64 Stamp)
+                {
+                    SetBenchQueues[Queue].Push(Stamp);
+                });
+
+                uint64 Received = 0, LatencySum = 0, EmptySweeps = 0;
+                while(Received < TotalMessages)
+                {
+                    bool bFoundAny = false;
+                    for(uint32 Queue = 0; Queue < QueueCount; ++Queue)
+                    {
+                        uint64 Stamp;
+                        if(SetBenchQueues[Queue].TryPop(Stamp))
+                        {
+                            LatencySum += NowNanoseconds() - Stamp;
+                            ++Received;
+                            bFoundAny = true;
+                        }
+                    }
+                    EmptySweeps += bFoundAny ? 0 : 1;
+                }
+                while(ProducersComplete.load() != ProducerCount)
+                {
+                    std::this_thread::yield();
+                }
+                printf("%2u queues, polling:   %7.1f us/msg latency, %llu empty sweeps, %.1f ms\n", QueueCount,
+                    LatencySum / 1e3 / Received, static_cast<unsigned long long>(EmptySweeps), SecondsSince(Start) * 1e3);
+            }
+
+            {
+                AtomicQueue::FQueueSet Set;
+                std::vector<FQueueSetBenchMember> Members;
+                Members.reserve(QueueCount);
+                for(uint32 Queue = 0; Queue < QueueCount; ++Queue)
+                {
+                    Members.emplace_back(SetBenchQueues[Queue], Set);
+                }
+
+                ProducersComplete.store(0);
+                const auto Start = std::chrono::steady_clock::now();
+                FQueueSetBenchMember* MemberData = Members.data();
+                StartBurstProducers(ProducerCount, MessageCount, QueueCount, [MemberData](const uint32 Queue, const uint64 Stamp)
+                {
+                    MemberData[Queue].Push(Stamp);
+                });
+
+                uint64 Received = 0, LatencySum = 0, Wakeups = 0;
+                while(Received < TotalMessages)
+                {
+                    uint64 Ready = Set.Wait();
+                    ++Wakeups;
+                    for(uint32 Queue = 0; Ready != 0; ++Queue, Ready >>= 1)
+                    {
+                        if((Ready & 1) == 0)
+                        {
+                            continue;
+                        }
+
+                        uint64 Stamp;
+                        while(MemberData[Queue].TryPop(Stamp))
+                        {
+                            LatencySum += NowNanoseconds() - Stamp;
+                            ++Received;
+                        }
+                    }
+                }
+                // The set and members live on this stack, producers still inside NotifyReady must leave first.
+                while(ProducersComplete.load() != ProducerCount)
+                {
+                    std::this_thread::yield();
+                }
+                printf("%2u queues, queue set: %7.1f us/msg latency, %llu wakeups, %.1f ms\n", QueueCount,
+                    LatencySum / 1e3 / Received, static_cast<unsigned long long>(Wakeups), SecondsSince(Start) * 1e3);
+            }
+        }
+    }
+}
+
+namespace QBenchmarks
+{
+    static AtomicQueue::TBoundedCircularQueue<uint64, COMBINING_BENCH_QUEUE_SIZE> FetchAddQueue;
+    static AtomicQueue::TFlatCombiningQueue<uint64, COMBINING_BENCH_QUEUE_SIZE, COMBINING_BENCH_MAX_THREADS> CombiningQueue;
+
+    /** Every thread pushes then pops OperationCount / ThreadCount times, returns ns per Push/Pop pair. */
+    template<typename TQueue>
+    static double PushPopPairNanoseconds(TQueue& Queue, const int ThreadCount, const int OperationCount)
+    {
+        const int PairsPerThread = OperationCount / ThreadCount;
+        const auto Start = std::chrono::steady_clock::now();
+
+        // Joined rather than detached, so every thread has handed its combining record back before the next run.
+        std::vector<std::thread> Threads;
+        for(int i = 0; i < ThreadCount; ++i)
+        {
+            Threads.emplace_back([&Queue, PairsPerThread, i]()
+            {
+                uint64 Sum = 0;
+                for(int j = 0; j < PairsPerThread; ++j)
+                {
+                    Queue.Push(static_cast<uint64>(i) << 32 | j);
+                    Sum += Queue.Pop();
+                }
+                TaskWorkSink.fetch_add(Sum, std::memory_order_relaxed);
+            });
+        }
+        for(std::thread& Thread : Threads)
+        {
+            Thread.join();
+        }
+        return SecondsSince(Start) * 1e9 / (static_cast<double>(PairsPerThread) * ThreadCount);
+    }
+
+    static void FlatCombiningCrossover(const int MaxThreadCount, const int OperationCount)
+    {
+        printf("threads  fetch_add ns/pair  combining ns/pair\n");
+
+        // The crossover is the lowest thread count from which combining stays ahead at every higher count.
+        int Crossover = 0;
+        for(int ThreadCount = 1; ThreadCount <= MaxThreadCount; ThreadCount *= 2)
+        {
+            const double FetchAdd = PushPopPairNanoseconds(FetchAddQueue, ThreadCount, OperationCount);
+            const double Combining = PushPopPairNanoseconds(CombiningQueue, ThreadCount, OperationCount);
+            printf("%7d  %17.1f  %17.1f\n", ThreadCount, FetchAdd, Combining);
+            if(Combining >= FetchAdd)
+            {
+                Crossover = 0;
+            }
+            else if(Crossover == 0)
+            {
+                Crossover = ThreadCount;
+            }
+        }
+        if(Crossover)
+        {
+            printf("TFlatCombiningQueue is faster from %d threads.\n", Crossover);
+        }
+        else
+        {
+            printf("TFlatCombiningQueue was not faster up to %d threads.\n", MaxThreadCount);
+        }
+    }
+}
+
+namespace QBenchmarks
+{
+    struct FKeyedMessage
+    {
+        uint32 Key;
+        uint32 Sequence;
+    };
+
+    static AtomicQueue::TStrandQueue<FKeyedMessage, STRAND_BENCH_KEYS> KeyedStrands;
+    static AtomicQueue::TBoundedCircularQueue<FKeyedMessage, 65536> WorkerQueues[STRAND_BENCH_WORKERS];
+
+    /* Only ever touched by the worker currently handling the key, so an out of order message is a real violation. */
+    static uint32 LastKeySequence[STRAND_BENCH_KEYS];
+    static uint32 NextKeySequence[STRAND_BENCH_KEYS];
+    static std::atomic<int> MessagesHandled = {0};
+    static std::atomic<int> OrderViolations = {0};
+
+    static FORCEINLINE void HandleKeyedMessage(const FKeyedMessage& Message)
+    {
+        if(Message.Sequence <= LastKeySequence[Message.Key])
+        {
+            OrderViolations.fetch_add(1, std::memory_order_relaxed);
+        }
+        LastKeySequence[Message.Key] = Message.Sequence;
+
+        uint64 Value = Message.Key;
+        for(uint64 i = 0; i < STRAND_BENCH_WORK; ++i)
+        {
+            Value = (Value ^ i) * 0x9E3779B97F4A7C15ull;
+        }
+        TaskWorkSink.fetch_add(Value, std::memory_order_relaxed);
+    }
+
+    static void ResetKeyedRun()
+    {
+        memset(LastKeySequence, 0, sizeof(LastKeySequence));
+        memset(NextKeySequence, 0, sizeof(NextKeySequence));
+        MessagesHandled.store(0);
+    }
+
+    /**
+     * One producer posts MessageCount messages. When skewed, half of them go to the keys that hash onto worker 0,
+     * which is the case fixed per-worker queues handle worst.
+     */
+    template<typename TPostFunction>
+    static void ProduceKeyedMessages(const int MessageCount, const bool bSkewed, const TPostFunction& PostMessage)
+    {
+        uint32 Random = 0x2545F491u;
+        for(int i = 0; i < MessageCount; ++i)
+        {
+            Random = Random * 1664525u + 1013904223u;
+            const uint32 Draw = Random >> 8;
+            const uint32 Key = bSkewed && (Draw & 1)
+                ? ((Draw >> 1) % (STRAND_BENCH_KEYS / STRAND_BENCH_WORKERS)) * STRAND_BENCH_WORKERS
+                : (Draw >> 1) % STRAND_BENCH_KEYS;
+            PostMessage(FKeyedMessage{Key, ++NextKeySequence[Key]});
+        }
+    }
+
+    static double StrandSeconds(const int WorkerCount, const int MessageCount, const bool bSkewed)
+    {
+        ResetKeyedRun();
+        const auto Start = std::chrono::steady_clock::now();
+        for(int i = 0; i < WorkerCount; ++i)
+        {
+            std::thread([MessageCount]()
+            {
+                while(MessagesHandled.load(std::memory_order_relaxed) < MessageCount)
+                {
+                    const uint Handled = KeyedStrands.RunReady(HandleKeyedMessage, STRAND_BENCH_BATCH);
+                    if(Handled)
+                    {
+                        MessagesHandled.fetch_add(Handled, std::memory_order_relaxed);
+                    }
+                    else
+                    {
+                        std::this_thread::yield();
+                    }
+                }
+                ThreadsComplete.fetch_add(1);
+            }).detach();
+        }
+        ProduceKeyedMessages(MessageCount, bSkewed, [](const FKeyedMessage& Message)
+        {
+            KeyedStrands.Post(Message.Key, Message);
+        });
+        WaitForCompletion(WorkerCount);
+        return SecondsSince(Start);
+    }
+
+    static double HashedWorkerSeconds(const int WorkerCount, const int MessageCount, const bool bSkewed)
+    {
+        ResetKeyedRun();
+        const auto Start = std::chrono::steady_clock::now();
+        for(int i = 0; i < WorkerCount; ++i)
+        {
+            std::thread([MessageCount, i]()
+            {
+                while(MessagesHandled.load(std::memory_order_relaxed) < MessageCount)
+                {
+                    uint Handled = 0;
+                    FKeyedMessage Message;
+                    while(Handled < STRAND_BENCH_BATCH && WorkerQueues[i].TryPop(Message))
+                    {
+                        HandleKeyedMessage(Message);
+                        ++Handled;
+                    }
+                    if(Handled)
+                    {
+                        MessagesHandled.fetch_add(Handled, std::memory_order_relaxed);
+                    }
+                    else
+                    {
+                        std::this_thread::yield();
+                    }
+                }
+                ThreadsComplete.fetch_add(1);
+            }).detach();
+        }
+        ProduceKeyedMessages(MessageCount, bSkewed, [WorkerCount](const FKeyedMessage& Message)
+        {
+            WorkerQueues[Message.Key % WorkerCount].Push(Message);
+        });
+        WaitForCompletion(WorkerCount);
+        return SecondsSince(Start);
+    }
+
+    static void StrandVersusHashedWorkers(const int WorkerCount, const int MessageCount)
+    {
+        for(const bool bSkewed : {false, true})
+        {
+            const char* Distribution = bSkewed ? "skewed " : "uniform";
+            const double Hashed = HashedWorkerSeconds(WorkerCount, MessageCount, bSkewed);
+            printf("%s keys, hashed per-worker queues: %.1f M msg/s\n", Distribution, MessageCount / Hashed / 1e6);
+            const double Strand = StrandSeconds(WorkerCount, MessageCount, bSkewed);
+            printf("%s keys, TStrandQueue:             %.1f M msg/s\n", Distribution, MessageCount / Strand / 1e6);
+        }
+        printf("Per-key order violations: %d\n", OrderViolations.load());
+    }
+}
+
+namespace QBenchmarks
+{
+    /** Tunes for a latency-bound 1:1 pipe of small messages and a bursty 4:4 exchange of cache-line sized ones. */
+    static void TuneQueueConfigurations(const uint32 ElementCount, const uint32 Repetitions)
+    {
+        using namespace AtomicQueue::Tuning;
+
+        const FWorkload Pipe = {"TTunedPipeQueue", 1, 1, ElementCount, 1, 0, Repetitions};
+        const FWorkload BurstyExchange = {"TTunedExchangeQueue", 4, 4, ElementCount / 4, 64, 20, Repetitions};
+
+        const FResult Results[] =
+        {
+            TQueueTuner<TPayload<8>, 256, 4096, 16384>::Run(Pipe),
+            TQueueTuner<TPayload<64>, 256, 4096, 16384>::Run(BurstyExchange),
+        };
+
+        if(!WriteRecommendationsHeader(TUNE_BENCH_OUTPUT, Results, 2))
+        {
+            printf("Could not write %s\n", TUNE_BENCH_OUTPUT);
+            return;
+        }
+        printf("Wrote recommended aliases to %s\n", TUNE_BENCH_OUTPUT);
+    }
+}
+
+namespace QBenchmarks
+{
+    /** Median of REFERENCE_BENCH_REPETITIONS runs, printed as one row of the reference matrix. */
+    template<typename TQueue>
+    static void ReferenceRow(const char* QueueName, const uint32 ThreadsPerSide, const uint Capacity)
+    {
+        using namespace AtomicQueue::Tuning;
+
+        const FWorkload Workload = {QueueName, ThreadsPerSide, ThreadsPerSide,
+            REFERENCE_BENCH_ELEMENTS / ThreadsPerSide, 1, 0, REFERENCE_BENCH_REPETITIONS};
+        std::vector<double> Samples;
+        for(uint32 i = 0; i < Workload.Repetitions; ++i)
+        {
+            Samples.push_back(MeasureOpsPerSecond<TQueue>(Workload));
+        }
+        std::sort(Samples.begin(), Samples.end());
+        printf("%3u:%-3u %5u B %6u  %-32s %8.2f M ops/s\n", ThreadsPerSide, ThreadsPerSide,
+            static_cast<uint>(sizeof(typename TQueue::TElementType)), Capacity, QueueName, Samples[Samples.size() / 2] / 1e6);
+    }
+
+    /* Atomic queues need a lock-free element with a nil value, so they only get the 8-byte rows. The workload pushes
+       value-initialized elements, so nil has to be something other than 0. */
+    template<uint TCapacity, typename TElement>
+    static void ReferenceAtomicRow(const uint32, const TElement*)
+    {
+    }
+
+    template<uint TCapacity>
+    static void ReferenceAtomicRow(const uint32 ThreadsPerSide, const uint64*)
+    {
+        ReferenceRow<AtomicQueue::TBoundedCircularAtomicQueue<uint64, TCapacity, ~0ULL>>("TBoundedCircularAtomicQueue", ThreadsPerSide, TCapacity);
+    }
+
+    template<typename TElement, uint TCapacity>
+    static void ReferenceCell(const uint32 ThreadsPerSide)
+    {
+        using namespace AtomicQueue::Reference;
+
+        ReferenceRow<AtomicQueue::TBoundedCircularQueue<TElement, TCapacity>>("TBoundedCircularQueue", ThreadsPerSide, TCapacity);
+        ReferenceAtomicRow<TCapacity>(ThreadsPerSide, static_cast<const TElement*>(nullptr));
+        ReferenceRow<TMutexDequeQueue<TElement, TCapacity>>("Reference::TMutexDequeQueue", ThreadsPerSide, TCapacity);
+        ReferenceRow<TVyukovQueue<TElement, TCapacity>>("Reference::TVyukovQueue", ThreadsPerSide, TCapacity);
+        if(ThreadsPerSide == 1)
+        {
+            ReferenceRow<AtomicQueue::TBoundedCircularQueue<TElement, TCapacity, true, true, true>>("TBoundedCircularQueue (TSPSC)", ThreadsPerSide, TCapacity);
+            ReferenceRow<TSPSCRingQueue<TElement, TCapacity>>("Reference::TSPSCRingQueue", ThreadsPerSide, TCapacity);
+        }
+    }
+
+    /**
+     * Runs every queue through the same producer:consumer, element size and capacity matrix. Every run uses fresh
+     * queues and fixed element counts, and the median of several runs is reported, so reruns on the same machine
+     * are comparable.
+     */
+    static void ReferenceQueueMatrix()
+    {
+        printf("Cache line %d bytes, %u hardware threads, %d elements per run, median of %d runs\n",
+            PLATFORM_CACHE_LINE_SIZE, std::thread::hardware_concurrency(), REFERENCE_BENCH_ELEMENTS, REFERENCE_BENCH_REPETITIONS);
+        printf("threads  elem    cap  queue                               throughput\n");
+        for(const uint32 ThreadsPerSide : {1u, 2u, 4u})
+        {
+            ReferenceCell<uint64, 1024>(ThreadsPerSide);
+            ReferenceCell<uint64, 65536>(ThreadsPerSide);
+            ReferenceCell<AtomicQueue::Tuning::TPayload<64>, 1024>(ThreadsPerSide);
+            ReferenceCell<AtomicQueue::Tuning::TPayload<64>, 65536>(ThreadsPerSide);
+        }
+    }
 }
 
 int main(int argc, char* argv[])
 {
+    if(argc > 1 && strcmp(argv[1], "trace") == 0)
+    {
+        QBenchmarks::SojournTraceOverhead(CORE_COUNT, ELEMENTS_TO_PROCESS);
+        return 0;
+    }
+    if(argc > 1 && strcmp(argv[1], "scheduler") == 0)
+    {
+        QBenchmarks::SchedulerFineGrainedTasks(SCHEDULER_BENCH_TASKS);
+        return 0;
+    }
+    if(argc > 1 && strcmp(argv[1], "pool") == 0)
+    {
+        QBenchmarks::ObjectPoolChurn(POOL_BENCH_THREADS, POOL_BENCH_MESSAGES);
+        return 0;
+    }
+    if(argc > 1 && strcmp(argv[1], "conflate") == 0)
+    {
+        QBenchmarks::ConflatingStateReplication(CONFLATE_BENCH_PRODUCERS, CONFLATE_BENCH_UPDATES);
+        return 0;
+    }
+
+    if(argc > 1 && strcmp(argv[1], "queueset") == 0)
+    {
+        QBenchmarks::QueueSetVersusPolling(QUEUESET_BENCH_PRODUCERS, QUEUESET_BENCH_MESSAGES);
+        return 0;
+    }
+
+    if(argc > 1 && strcmp(argv[1], "combining") == 0)
+    {
+        QBenchmarks::FlatCombiningCrossover(COMBINING_BENCH_MAX_THREADS, COMBINING_BENCH_OPS);
+        return 0;
+    }
+
+    if(argc > 1 && strcmp(argv[1], "strand") == 0)
+    {
+        QBenchmarks::StrandVersusHashedWorkers(STRAND_BENCH_WORKERS, STRAND_BENCH_MESSAGES);
+        return 0;
+    }
+
+    if(argc > 1 && strcmp(argv[1], "tune") == 0)
+    {
+        QBenchmarks::TuneQueueConfigurations(TUNE_BENCH_ELEMENTS, TUNE_BENCH_REPETITIONS);
+        return 0;
+    }
+
+    if(argc > 1 && strcmp(argv[1], "reference") == 0)
+    {
+        QBenchmarks::ReferenceQueueMatrix();
+        return 0;
+    }
+
     QBenchmarks::NoDelayHighContentionRegular(CORE_COUNT, ELEMENTS_TO_PROCESS);
-    
+
     return 0;
 }